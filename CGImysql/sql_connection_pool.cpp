@@ -32,6 +32,7 @@ void connection_pool::init(string url, string User, string PassWord, string DBNa
 	this->DatabaseName = DBName;
 
 	lock.lock();		// 上锁
+	connList.reserve(MaxConn);
 	for (int i = 0; i < MaxConn; i++)
 	{
 		MYSQL *con = NULL;
@@ -73,8 +74,8 @@ MYSQL *connection_pool::GetConnection()
 	
 	lock.lock();
 
-	con = connList.front();
-	connList.pop_front();
+	con = connList.back();
+	connList.pop_back();
 
 	--FreeConn;
 	++CurConn;
@@ -108,7 +109,7 @@ void connection_pool::DestroyPool()
 	lock.lock();
 	if (connList.size() > 0)
 	{
-		list<MYSQL *>::iterator it;
+		vector<MYSQL *>::iterator it;
 		for (it = connList.begin(); it != connList.end(); ++it)
 		{
 			MYSQL *con = *it;
@@ -2,7 +2,7 @@
 #define _CONNECTION_POOL_
 
 #include <stdio.h>
-#include <list>
+#include <vector>
 #include <mysql/mysql.h>
 #include <error.h>
 #include <string.h>
@@ -34,7 +34,7 @@ private:
 
 private:
 	locker lock;
-	list<MYSQL *> connList; //连接池
+	vector<MYSQL *> connList; //连接池，按栈使用，取还连接不分配内存
 	sem reserve;	
 
 private:
@@ -0,0 +1,287 @@
+﻿#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include "file_cache.h"
+
+//FNV-1a
+static unsigned int hash_path(const char *path)
+{
+    unsigned int h = 2166136261u;
+    for (; *path; ++path)
+    {
+        h ^= (unsigned char)*path;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+//文件在打开之后是否被替换或修改过
+static bool same_file(const struct stat &a, const struct stat &b)
+{
+    return a.st_ino == b.st_ino && a.st_dev == b.st_dev && a.st_size == b.st_size &&
+           a.st_mtim.tv_sec == b.st_mtim.tv_sec && a.st_mtim.tv_nsec == b.st_mtim.tv_nsec;
+}
+
+file_cache::file_cache() : m_max_bytes(0), m_cur_bytes(0), m_resp_hits(0), m_resp_misses(0), m_map(false), m_head(NULL), m_tail(NULL)
+{
+    memset(m_buckets, 0, sizeof(m_buckets));
+}
+
+file_cache::~file_cache()
+{
+    while (m_head)
+    {
+        file_entry *entry = m_head;
+        unlink(entry);
+        if (entry->ref == 0)
+            destroy(entry);
+    }
+}
+
+file_cache *file_cache::GetInstance()
+{
+    static file_cache cache;
+    return &cache;
+}
+
+void file_cache::init(size_t max_bytes, bool map)
+{
+    m_max_bytes = max_bytes;
+    m_map = map;
+}
+
+file_entry *file_cache::find(const char *path, unsigned int hash)
+{
+    for (file_entry *entry = m_buckets[hash & (BUCKET_NUM - 1)]; entry; entry = entry->hnext)
+    {
+        if (strcmp(entry->path, path) == 0)
+            return entry;
+    }
+    return NULL;
+}
+
+void file_cache::unlink(file_entry *entry)
+{
+    file_entry **pp = &m_buckets[hash_path(entry->path) & (BUCKET_NUM - 1)];
+    while (*pp != entry)
+        pp = &(*pp)->hnext;
+    *pp = entry->hnext;
+
+    if (entry->prev)
+        entry->prev->next = entry->next;
+    else
+        m_head = entry->next;
+    if (entry->next)
+        entry->next->prev = entry->prev;
+    else
+        m_tail = entry->prev;
+
+    entry->linked = false;
+    m_cur_bytes -= entry->bytes;
+}
+
+void file_cache::destroy(file_entry *entry)
+{
+    if (entry->addr)
+        munmap(entry->addr, entry->st.st_size);
+    for (int i = 0; i < 2; ++i)
+    {
+        free(entry->resp[i][0]);
+        free(entry->resp[i][1]);
+    }
+    close(entry->fd);
+    free(entry->path);
+    delete entry;
+}
+
+void file_cache::evict()
+{
+    file_entry *entry = m_tail;
+    while (entry && m_cur_bytes > m_max_bytes)
+    {
+        file_entry *prev = entry->prev;
+        if (entry->ref == 0)
+        {
+            unlink(entry);
+            destroy(entry);
+        }
+        entry = prev;
+    }
+}
+
+int file_cache::acquire(const char *path, file_entry *&entry, struct stat &st)
+{
+    entry = NULL;
+    unsigned int hash = hash_path(path);
+    time_t now = time(NULL);
+
+    m_lock.lock();
+    file_entry *found = find(path, hash);
+    if (found && now - found->checked >= VALID_SEC)
+    {
+        //有效期已过，和磁盘上的文件核对
+        if (stat(path, &st) < 0)
+        {
+            unlink(found);
+            if (found->ref == 0)
+                destroy(found);
+            m_lock.unlock();
+            return -1;
+        }
+        if (same_file(st, found->st))
+        {
+            found->checked = now;
+        }
+        else
+        {
+            unlink(found);
+            if (found->ref == 0)
+                destroy(found);
+            found = NULL;
+        }
+    }
+    if (found)
+    {
+        //移到LRU表头
+        if (found != m_head)
+        {
+            found->prev->next = found->next;
+            if (found->next)
+                found->next->prev = found->prev;
+            else
+                m_tail = found->prev;
+            found->prev = NULL;
+            found->next = m_head;
+            m_head->prev = found;
+            m_head = found;
+        }
+        ++found->ref;
+        st = found->st;
+        entry = found;
+        m_lock.unlock();
+        return 0;
+    }
+    m_lock.unlock();
+
+    //未命中，在锁外打开文件
+    if (stat(path, &st) < 0)
+        return -1;
+    if (!S_ISREG(st.st_mode) || !(st.st_mode & S_IROTH) || (size_t)st.st_size > m_max_bytes)
+        return 0;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return 0;
+    //以打开的文件为准，避免stat和open之间文件被替换
+    fstat(fd, &st);
+    char *addr = NULL;
+    if (m_map && st.st_size > 0)
+    {
+        addr = (char *)mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (addr == MAP_FAILED)
+        {
+            close(fd);
+            return 0;
+        }
+    }
+
+    file_entry *created = new file_entry;
+    created->path = strdup(path);
+    created->fd = fd;
+    created->addr = addr;
+    memset(created->resp, 0, sizeof(created->resp));
+    memset(created->resp_len, 0, sizeof(created->resp_len));
+    created->bytes = st.st_size;
+    created->st = st;
+    created->checked = now;
+    created->ref = 1;
+
+    m_lock.lock();
+    //其他线程可能已经先加入了同一个文件，用新打开的替换它
+    found = find(path, hash);
+    if (found)
+    {
+        unlink(found);
+        if (found->ref == 0)
+            destroy(found);
+    }
+    unsigned int bucket = hash & (BUCKET_NUM - 1);
+    created->hnext = m_buckets[bucket];
+    m_buckets[bucket] = created;
+    created->prev = NULL;
+    created->next = m_head;
+    if (m_head)
+        m_head->prev = created;
+    else
+        m_tail = created;
+    m_head = created;
+    created->linked = true;
+    m_cur_bytes += created->bytes;
+    evict();
+    m_lock.unlock();
+
+    entry = created;
+    return 0;
+}
+
+void file_cache::release(file_entry *entry)
+{
+    m_lock.lock();
+    --entry->ref;
+    //已经被淘汰或过期的条目，最后一个引用归还时释放
+    if (entry->ref == 0 && !entry->linked)
+        destroy(entry);
+    m_lock.unlock();
+}
+
+bool file_cache::get_response(file_entry *entry, bool encoded, bool keep_alive, const char *&resp, int &len)
+{
+    if (entry->st.st_size == 0 || entry->st.st_size > RESP_MAX)
+        return false;
+    //响应只生成一次，之后不再修改，发布时先写长度再写指针
+    char *p = __atomic_load_n(&entry->resp[encoded][keep_alive], __ATOMIC_ACQUIRE);
+    if (!p)
+    {
+        __sync_fetch_and_add(&m_resp_misses, 1);
+        return false;
+    }
+    __sync_fetch_and_add(&m_resp_hits, 1);
+    resp = p;
+    len = entry->resp_len[encoded][keep_alive];
+    return true;
+}
+
+void file_cache::put_response(file_entry *entry, bool encoded, bool keep_alive, const char *head, int head_len)
+{
+    int size = entry->st.st_size;
+    if (size == 0 || size > RESP_MAX || __atomic_load_n(&entry->resp[encoded][keep_alive], __ATOMIC_ACQUIRE))
+        return;
+    char *resp = (char *)malloc(head_len + size);
+    if (!resp)
+        return;
+    memcpy(resp, head, head_len);
+    //sendfile方式没有映射，从打开的文件读出正文
+    if (entry->addr)
+        memcpy(resp + head_len, entry->addr, size);
+    else if (pread(entry->fd, resp + head_len, size, 0) != size)
+    {
+        free(resp);
+        return;
+    }
+
+    m_lock.lock();
+    //其他线程已经生成过时丢弃这一份
+    if (entry->resp[encoded][keep_alive])
+    {
+        m_lock.unlock();
+        free(resp);
+        return;
+    }
+    entry->resp_len[encoded][keep_alive] = head_len + size;
+    __atomic_store_n(&entry->resp[encoded][keep_alive], resp, __ATOMIC_RELEASE);
+    entry->bytes += head_len + size;
+    if (entry->linked)
+        m_cur_bytes += head_len + size;
+    m_lock.unlock();
+}
@@ -0,0 +1,98 @@
+﻿#ifndef FILE_CACHE_H
+#define FILE_CACHE_H
+
+#include <time.h>
+#include <sys/stat.h>
+#include "../lock/locker.h"
+
+//缓存的一个文件
+struct file_entry
+{
+    char *path;
+    int fd;                 //打开的文件，sendfile直接使用
+    char *addr;             //整个文件的只读映射，只在mmap方式下建立
+    //小文件预先生成的完整响应，下标为是否作为另一个文件的压缩版本发送、是否保持连接。
+    //.gz/.br文件协商后发送时带原文件的Content-Type和Content-Encoding，直接请求时没有，两种响应分开缓存
+    char *resp[2][2];
+    int resp_len[2][2];
+    size_t bytes;           //计入缓存总大小的字节数，文件加上预生成的响应
+    struct stat st;         //打开时的stat结果，用于判断文件是否被修改
+    time_t checked;         //上次和磁盘上的文件核对的时间
+    int ref;                //正在使用的请求数，为0时才能释放
+    bool linked;            //是否还在哈希表和LRU链表中
+
+    file_entry *hnext;      //哈希桶链
+    file_entry *prev;       //LRU链表，表头是最近使用的
+    file_entry *next;
+};
+
+// 静态文件缓存，所有事件循环和工作线程共享，单例
+// 以拼接好的文件路径为键，缓存stat结果、打开的fd和mmap映射，命中时不再有stat/open/mmap/close/munmap。
+// 每个请求通过引用计数持有条目，发送完才归还，淘汰或过期的条目在最后一个引用归还时才关闭。
+// 缓存的文件总大小超过上限时从LRU链表尾部淘汰没有被引用的条目。
+// 条目超过VALID_SEC秒后再次使用时重新stat，mtime、inode或大小变化则换成新打开的文件。
+// 哈希表和链表都是侵入式的，命中时不分配内存。
+// 不超过RESP_MAX的小文件还缓存状态行、消息头和正文拼好的完整响应，命中时直接发送，不再生成头部。
+// 完整响应随条目一起过期，文件修改后换成新条目时重新生成。
+class file_cache
+{
+public:
+    static file_cache *GetInstance();
+
+    //max_bytes为0时不启用缓存，map为true时同时建立mmap映射
+    void init(size_t max_bytes, bool map);
+    bool enabled()
+    {
+        return m_max_bytes > 0;
+    }
+
+    //查找path，不在缓存中时打开并加入缓存，st返回文件的stat结果
+    //返回-1表示stat失败；返回0时entry非空表示取得了缓存的文件，
+    //为空表示文件不适合缓存(不是普通文件、没有读权限、超出缓存上限或打开失败)，由调用者按st处理
+    int acquire(const char *path, file_entry *&entry, struct stat &st);
+    //请求用完后归还条目
+    void release(file_entry *entry);
+
+    //取预生成的完整响应，encoded为是否带Content-Encoding发送，keep_alive对应Connection头，没有时返回false
+    bool get_response(file_entry *entry, bool encoded, bool keep_alive, const char *&resp, int &len);
+    //第一次响应小文件后，把生成的头部head和文件内容拼成完整响应存进条目
+    void put_response(file_entry *entry, bool encoded, bool keep_alive, const char *head, int head_len);
+    unsigned long response_hits()
+    {
+        return m_resp_hits;
+    }
+    unsigned long response_misses()
+    {
+        return m_resp_misses;
+    }
+
+public:
+    static const int RESP_MAX = 4096;       //预生成完整响应的文件大小上限
+
+private:
+    file_cache();
+    ~file_cache();
+
+    file_entry *find(const char *path, unsigned int hash);
+    //从哈希表和LRU链表中摘下，之后没有引用时释放
+    void unlink(file_entry *entry);
+    void destroy(file_entry *entry);
+    //淘汰没有被引用的条目，直到总大小不超过上限
+    void evict();
+
+private:
+    static const int BUCKET_NUM = 1024;     //哈希桶数，2的幂
+    static const int VALID_SEC = 1;         //条目不重新核对的有效期
+
+    size_t m_max_bytes;
+    size_t m_cur_bytes;
+    unsigned long m_resp_hits;              //完整响应的命中和未命中次数
+    unsigned long m_resp_misses;
+    bool m_map;
+    file_entry *m_buckets[BUCKET_NUM];
+    file_entry *m_head;                     //LRU链表
+    file_entry *m_tail;
+    locker m_lock;
+};
+
+#endif
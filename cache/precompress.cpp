@@ -0,0 +1,211 @@
+﻿#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <strings.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#include <brotli/encode.h>
+#include "precompress.h"
+
+static const char *compressible_ext[] = {".html", ".htm", ".css", ".js", ".json", ".txt", ".xml", ".svg", NULL};
+
+bool is_compressible(const char *path)
+{
+    const char *ext = strrchr(path, '.');
+    if (!ext || strchr(ext, '/'))
+        return false;
+    for (int i = 0; compressible_ext[i]; ++i)
+    {
+        if (strcasecmp(ext, compressible_ext[i]) == 0)
+            return true;
+    }
+    return false;
+}
+
+//gzip格式，最高压缩级别，只在启动时做一次
+static size_t gzip_compress(const char *src, size_t len, char *dst, size_t cap)
+{
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    //windowBits加16输出gzip头而不是zlib头
+    if (deflateInit2(&zs, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 9, Z_DEFAULT_STRATEGY) != Z_OK)
+        return 0;
+    zs.next_in = (Bytef *)src;
+    zs.avail_in = len;
+    zs.next_out = (Bytef *)dst;
+    zs.avail_out = cap;
+    int ret = deflate(&zs, Z_FINISH);
+    size_t out = zs.total_out;
+    deflateEnd(&zs);
+    return ret == Z_STREAM_END ? out : 0;
+}
+
+static size_t br_compress(const char *src, size_t len, char *dst, size_t cap)
+{
+    size_t out = cap;
+    if (!BrotliEncoderCompress(BROTLI_MAX_QUALITY, BROTLI_DEFAULT_WINDOW, BROTLI_MODE_TEXT,
+                               len, (const uint8_t *)src, &out, (uint8_t *)dst))
+        return 0;
+    return out;
+}
+
+//先写临时文件再rename，服务中的请求不会读到写了一半的压缩文件
+static bool write_file(const char *path, const char *data, size_t len)
+{
+    char tmp[PATH_MAX + 5];
+    //路径被截断时rename会把文件改成错误的名字，不生成
+    if (snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= (int)sizeof(tmp))
+        return false;
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return false;
+    size_t done = 0;
+    while (done < len)
+    {
+        ssize_t n = write(fd, data + done, len - done);
+        if (n <= 0)
+        {
+            close(fd);
+            unlink(tmp);
+            return false;
+        }
+        done += n;
+    }
+    close(fd);
+    if (rename(tmp, path) < 0)
+    {
+        unlink(tmp);
+        return false;
+    }
+    return true;
+}
+
+//为一个文件生成压缩文件，返回生成的个数
+static int precompress_file(const char *path, const struct stat &st, int encodings)
+{
+    static const struct
+    {
+        int enc;
+        const char *suffix;
+        size_t (*compress)(const char *, size_t, char *, size_t);
+    } codecs[] = {{ENC_GZIP, ".gz", gzip_compress}, {ENC_BR, ".br", br_compress}};
+
+    char *src = NULL, *dst = NULL;
+    int made = 0;
+    for (size_t i = 0; i < sizeof(codecs) / sizeof(codecs[0]); ++i)
+    {
+        if (!(encodings & codecs[i].enc))
+            continue;
+        char out_path[PATH_MAX];
+        if (snprintf(out_path, sizeof(out_path), "%s%s", path, codecs[i].suffix) >= (int)sizeof(out_path))
+            continue;
+        //压缩文件比原文件新，不需要重新生成
+        struct stat out_st;
+        if (stat(out_path, &out_st) == 0 && out_st.st_mtime >= st.st_mtime)
+            continue;
+
+        if (!src)
+        {
+            src = (char *)malloc(st.st_size + 1);
+            dst = (char *)malloc(st.st_size + 1);
+            int fd = open(path, O_RDONLY);
+            if (!src || !dst || fd < 0 || read(fd, src, st.st_size) != st.st_size)
+            {
+                if (fd >= 0)
+                    close(fd);
+                break;
+            }
+            close(fd);
+        }
+        //输出空间只给到原文件大小，放不下说明压缩没有收益
+        size_t len = codecs[i].compress(src, st.st_size, dst, st.st_size);
+        if (len == 0 || len >= (size_t)st.st_size)
+        {
+            //删掉过期的压缩文件，避免以后被当成有效的
+            unlink(out_path);
+            continue;
+        }
+        if (write_file(out_path, dst, len))
+            ++made;
+    }
+    free(src);
+    free(dst);
+    return made;
+}
+
+int precompress_dir(const char *root, int encodings)
+{
+    DIR *dir = opendir(root);
+    if (!dir)
+        return 0;
+    int made = 0;
+    struct dirent *ent;
+    while ((ent = readdir(dir)) != NULL)
+    {
+        if (ent->d_name[0] == '.')
+            continue;
+        char path[PATH_MAX];
+        if (snprintf(path, sizeof(path), "%s/%s", root, ent->d_name) >= (int)sizeof(path))
+            continue;
+        struct stat st;
+        if (stat(path, &st) < 0)
+            continue;
+        if (S_ISDIR(st.st_mode))
+            made += precompress_dir(path, encodings);
+        else if (S_ISREG(st.st_mode) && st.st_size > 0 && is_compressible(path))
+            made += precompress_file(path, st, encodings);
+    }
+    closedir(dir);
+    return made;
+}
+
+int parse_accept_encoding(const char *value)
+{
+    //明确接受的、明确拒绝的和*，和出现的顺序无关
+    int accept = 0, reject = 0, star = 0;
+    const char *p = value;
+    while (*p)
+    {
+        p += strspn(p, " \t,");
+        if (!*p)
+            break;
+        //编码名到;或,为止
+        const char *name = p;
+        size_t name_len = strcspn(p, " \t;,");
+        const char *end = p + strcspn(p, ",");
+        //q=0表示明确不接受
+        bool rejected = false;
+        for (const char *q = name + name_len; (q = (const char *)memchr(q, ';', end - q)) != NULL;)
+        {
+            ++q;
+            q += strspn(q, " \t");
+            if ((q[0] == 'q' || q[0] == 'Q') && q[1] == '=')
+            {
+                rejected = atof(q + 2) <= 0;
+                break;
+            }
+        }
+        p = end;
+
+        int enc = 0;
+        if (name_len == 4 && strncasecmp(name, "gzip", 4) == 0)
+            enc = ENC_GZIP;
+        else if (name_len == 2 && strncasecmp(name, "br", 2) == 0)
+            enc = ENC_BR;
+        else if (name_len == 1 && name[0] == '*')
+        {
+            if (!rejected)
+                star = ENC_GZIP | ENC_BR;
+            continue;
+        }
+        if (rejected)
+            reject |= enc;
+        else
+            accept |= enc;
+    }
+    return (accept | star) & ~reject;
+}
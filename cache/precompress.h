@@ -0,0 +1,21 @@
+﻿#ifndef PRECOMPRESS_H
+#define PRECOMPRESS_H
+
+//预压缩的编码，同时作为Accept-Encoding解析结果的位
+enum
+{
+    ENC_GZIP = 1,
+    ENC_BR = 2
+};
+
+//按扩展名判断是否是值得压缩的文本类型(html/css/js等)
+bool is_compressible(const char *path);
+
+//启动时遍历网站根目录，为可压缩的文件生成.gz(encodings含ENC_BR时还有.br)兄弟文件。
+//已有的压缩文件比原文件新时跳过，压缩后不比原文件小的不生成，返回生成的文件数
+int precompress_dir(const char *root, int encodings);
+
+//解析Accept-Encoding的值，返回客户端接受的ENC_*，q=0的编码视为不接受
+int parse_accept_encoding(const char *value);
+
+#endif
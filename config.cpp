@@ -0,0 +1,163 @@
+﻿#include "config.h"
+#include <stdio.h>
+#include "./eventloop/eventloop.h"
+
+#define MAX_READ_BUF_KB (1024 * 1024)     //读缓冲区上限最大1GB，换算成字节后不超出int
+#define MAX_FILE_CACHE_MB (64 * 1024)     //文件缓存最大64GB
+#define MAX_TIMEOUT_MS (24 * 3600 * 1000) //超时最长一天
+
+//取值只能在[lo, hi]之间的选项，超出范围时报错退出，避免后面按未定义的取值运行
+static int range_arg(int opt, const char *arg, int lo, int hi)
+{
+    char *end;
+    long v = strtol(arg, &end, 10);
+    if (*arg == '\0' || *end != '\0' || v < lo || v > hi)
+    {
+        fprintf(stderr, "invalid -%c %s, expected %d..%d\n", opt, arg, lo, hi);
+        exit(1);
+    }
+    return v;
+}
+
+config::config()
+{
+    //端口号,默认9006
+    port = 9006;
+
+    //事件循环数量,默认1,即单reactor
+    reactor_num = 1;
+
+    //I/O后端,默认epoll
+    io_backend = 0;
+
+    //并发模型,默认模拟Proactor
+    actor_model = 0;
+
+    //backlog,默认1024
+    backlog = 1024;
+
+    //accept方式,默认每个事件循环自己accept
+    accept_mode = 0;
+
+    //最大连接数,默认65536
+    max_conn = 65536;
+
+    //连接对象池大页,默认不使用
+    huge_page = 0;
+
+    //读缓冲区上限,默认64KB
+    read_buf_max = 64;
+
+    //静态文件发送方式,默认mmap+writev
+    sendfile = 0;
+
+    //静态文件缓存,默认不使用
+    file_cache = 0;
+
+    //预压缩,默认不使用
+    precompress = 0;
+
+    //请求头超时,默认10秒
+    header_timeout = 10000;
+
+    //空闲超时,默认15秒
+    idle_timeout = 15000;
+
+    //长连接超时,默认15秒
+    keepalive_timeout = 15000;
+
+    //线程池调度方式,默认共用一个请求队列
+    scheduler = 0;
+}
+
+void config::parse_arg(int argc, char *argv[])
+{
+    int opt;
+    const char *str = "r:i:a:b:c:m:H:R:s:f:z:T:t:k:w:";
+    while ((opt = getopt(argc, argv, str)) != -1)
+    {
+        switch (opt)
+        {
+        case 'r':
+        {
+            reactor_num = range_arg(opt, optarg, 1, MAX_LOOPS);
+            break;
+        }
+        case 'i':
+        {
+            io_backend = range_arg(opt, optarg, 0, 1);
+            break;
+        }
+        case 'a':
+        {
+            actor_model = range_arg(opt, optarg, 0, 1);
+            break;
+        }
+        case 'b':
+        {
+            backlog = range_arg(opt, optarg, 1, 65535);
+            break;
+        }
+        case 'c':
+        {
+            accept_mode = range_arg(opt, optarg, 0, 2);
+            break;
+        }
+        case 'm':
+        {
+            max_conn = range_arg(opt, optarg, 1, MAX_FD);
+            break;
+        }
+        case 'H':
+        {
+            huge_page = range_arg(opt, optarg, 0, 1);
+            break;
+        }
+        case 'R':
+        {
+            read_buf_max = range_arg(opt, optarg, http_conn::READ_BUFFER_SIZE / 1024, MAX_READ_BUF_KB);
+            break;
+        }
+        case 's':
+        {
+            sendfile = range_arg(opt, optarg, 0, 1);
+            break;
+        }
+        case 'f':
+        {
+            file_cache = range_arg(opt, optarg, 0, MAX_FILE_CACHE_MB);
+            break;
+        }
+        case 'z':
+        {
+            precompress = range_arg(opt, optarg, 0, 2);
+            break;
+        }
+        case 'T':
+        {
+            header_timeout = range_arg(opt, optarg, 1, MAX_TIMEOUT_MS);
+            break;
+        }
+        case 't':
+        {
+            idle_timeout = range_arg(opt, optarg, 1, MAX_TIMEOUT_MS);
+            break;
+        }
+        case 'k':
+        {
+            keepalive_timeout = range_arg(opt, optarg, 1, MAX_TIMEOUT_MS);
+            break;
+        }
+        case 'w':
+        {
+            scheduler = range_arg(opt, optarg, 0, 2);
+            break;
+        }
+        default:
+            break;
+        }
+    }
+    //getopt会把非选项参数(端口号)挪到最后
+    if (optind < argc)
+        port = atoi(argv[optind]);
+}
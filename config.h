@@ -0,0 +1,71 @@
+﻿#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <unistd.h>
+#include <stdlib.h>
+
+// 命令行参数解析
+// 用法: ./server port [-r reactor_num] [-i io_backend] [-a actor_model]
+//                    [-b backlog] [-c accept_mode] [-m max_conn] [-H huge_page]
+//                    [-R read_buf_max] [-s sendfile] [-f file_cache]
+//                    [-z precompress] [-T header_timeout] [-t idle_timeout]
+//                    [-k keepalive_timeout] [-w scheduler]
+class config
+{
+public:
+    config();
+    ~config(){};
+
+    void parse_arg(int argc, char *argv[]);
+
+    //端口号
+    int port;
+
+    //事件循环(reactor)数量，大于1时每个事件循环使用SO_REUSEPORT独立监听
+    int reactor_num;
+
+    //I/O后端，0:epoll 1:io_uring
+    int io_backend;
+
+    //并发模型，0:模拟Proactor 1:Reactor
+    int actor_model;
+
+    //listen的backlog
+    int backlog;
+
+    //accept方式，0:每个事件循环自己accept 1:独立的accept线程 2:共享监听socket+EPOLLEXCLUSIVE
+    int accept_mode;
+
+    //最大连接数，超出后新连接直接回复503
+    int max_conn;
+
+    //连接对象池是否使用大页，0:不使用 1:使用
+    int huge_page;
+
+    //每个连接读缓冲区的上限，单位KB，请求头或消息体超出时关闭连接
+    int read_buf_max;
+
+    //静态文件发送方式，0:mmap+writev 1:sendfile
+    int sendfile;
+
+    //静态文件缓存的上限，单位MB，0为不使用缓存
+    int file_cache;
+
+    //预压缩静态文件，0不使用，1生成gzip，2生成gzip和br
+    int precompress;
+
+    //请求头超时，单位毫秒，从请求的第一个字节算起，请求头收完前不延长
+    int header_timeout;
+
+    //空闲超时，单位毫秒，接收消息体或发送响应时超过这么久没有进展就关闭
+    int idle_timeout;
+
+    //长连接超时，单位毫秒，响应发完后等待下一个请求的时间
+    int keepalive_timeout;
+
+    //线程池调度方式，0:所有工作线程共用一个请求队列 1:每个工作线程一个队列，空闲时窃取其他线程的请求
+    //2:同一连接的请求固定交给一个工作线程，排队过长时改投或被窃取
+    int scheduler;
+};
+
+#endif
@@ -0,0 +1,106 @@
+﻿#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <cassert>
+#include <sys/eventfd.h>
+#include "acceptor.h"
+
+extern int addfd(int epollfd, int fd, bool one_shot);
+
+acceptor::acceptor() : m_epollfd(-1), m_listenfd(-1), m_stopfd(-1), m_max_conn(MAX_FD), m_loops(NULL), m_loop_num(0), m_next(0)
+{
+}
+
+acceptor::~acceptor()
+{
+    close(m_epollfd);
+    close(m_stopfd);
+}
+
+void acceptor::init(const config &conf, int listenfd, eventloop **loops, int loop_num)
+{
+    m_listenfd = listenfd;
+    m_max_conn = conf.max_conn;
+    m_loops = loops;
+    m_loop_num = loop_num;
+
+    m_epollfd = epoll_create(5);
+    assert(m_epollfd != -1);
+    addfd(m_epollfd, m_listenfd, false);
+
+    m_stopfd = eventfd(0, EFD_CLOEXEC);
+    assert(m_stopfd >= 0);
+    addfd(m_epollfd, m_stopfd, false);
+}
+
+void acceptor::stop()
+{
+    eventfd_write(m_stopfd, 1);
+}
+
+void *acceptor::worker(void *arg)
+{
+    acceptor *acc = (acceptor *)arg;
+    acc->loop();
+    return acc;
+}
+
+void acceptor::deal_accept()
+{
+    struct sockaddr_in client_address;
+
+    while (1)
+    {
+        socklen_t client_addrlength = sizeof(client_address);
+        int connfd = accept4(m_listenfd, (struct sockaddr *)&client_address, &client_addrlength, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (connfd < 0)
+        {
+            if (errno != EAGAIN)
+                printf("accept error:errno is:%d\n", errno);
+            break;
+        }
+        if (connfd >= MAX_FD)
+        {
+            reject_conn(connfd);
+            continue;
+        }
+        //连接数要到事件循环add_conn时才会增加，一次取出的一批连接都会通过检查，
+        //所以在这里原子地先占一个名额，超出上限再归还，事件循环不再重复计数
+        if (__sync_add_and_fetch(&http_conn::m_user_count, 1) > m_max_conn)
+        {
+            __sync_fetch_and_sub(&http_conn::m_user_count, 1);
+            reject_conn(connfd);
+            continue;
+        }
+        m_loops[m_next]->post_accept(connfd, client_address);
+        m_next = (m_next + 1) % m_loop_num;
+    }
+}
+
+void acceptor::loop()
+{
+    bool stop_server = false;
+    epoll_event events[2];
+
+    while (!stop_server)
+    {
+        int number = epoll_wait(m_epollfd, events, 2, -1);
+        if (number < 0 && errno != EINTR)
+        {
+            printf("!!!!!acceptor epoll failure!!!!!");
+            break;
+        }
+        for (int i = 0; i < number; i++)
+        {
+            int sockfd = events[i].data.fd;
+            if (sockfd == m_listenfd)
+            {
+                deal_accept();
+            }
+            else if (sockfd == m_stopfd)
+            {
+                stop_server = true;
+            }
+        }
+    }
+}
@@ -0,0 +1,36 @@
+﻿#ifndef ACCEPTOR_H
+#define ACCEPTOR_H
+
+#include "eventloop.h"
+
+// 独立的accept线程
+// 只负责监听socket：用accept4把积压的连接一次取完，按轮询交给各个事件循环，
+// 连接数超出上限时直接回复503并关闭，连接风暴不会占用事件循环处理请求的时间。
+class acceptor
+{
+public:
+    acceptor();
+    ~acceptor();
+
+    void init(const config &conf, int listenfd, eventloop **loops, int loop_num);
+    //运行直到调用stop
+    void loop();
+    //让accept线程退出，由主线程在0号循环收到SIGTERM后调用
+    void stop();
+    //pthread_create的入口，arg为acceptor对象
+    static void *worker(void *arg);
+
+private:
+    void deal_accept();
+
+private:
+    int m_epollfd;
+    int m_listenfd;
+    int m_stopfd;           //eventfd，stop时写入
+    int m_max_conn;
+    eventloop **m_loops;
+    int m_loop_num;
+    int m_next;             //下一个接收新连接的事件循环
+};
+
+#endif
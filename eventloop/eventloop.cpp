@@ -0,0 +1,584 @@
+﻿#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <cassert>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <sys/signalfd.h>
+#include "eventloop.h"
+#ifdef ALLOC_STAT
+#include "../slab/alloc_stat.h"
+#endif
+
+//这三个函数在http_conn.cpp中定义，改变链接属性
+extern int addfd(int epollfd, int fd, bool one_shot);
+extern int remove(int epollfd, int fd);
+extern int setnonblocking(int fd);
+extern void modfd(int epollfd, int fd, int ev);
+
+//所有事件循环共享的连接池，定时器回调关闭连接后把对象放回
+static conn_slab<conn_slot> *conns_slab = NULL;
+
+//设置信号函数
+void addsig(int sig, void(handler)(int), bool restart)
+{
+    struct sigaction sa;
+    /*
+    struct sigaction {
+        void ( * sa_handler) ( int ) ;      /*sa_handler字段包含一个信号捕捉函数的地址
+        sigset_t sa_mask;       /*sa_mask字段说明了一个信号集，在调用该信号捕捉函数之前，
+                                这一信号集要加进进程的信号屏蔽字中。仅当从信号捕捉函数返回时再将进程的信号屏蔽字复位为原先值。
+                                
+        int sa_flag;        /*sa_flag是一个选项，主要理解两个
+                            SA_INTERRUPT 由此信号中断的系统调用不会自动重启
+                            SA_RESTART 由此信号中断的系统调用会自动重启
+        void ( * sa_sigaction) ( int , siginfo_t * , void * ) ;  /* 不太用得到
+    } ;
+    */
+    memset(&sa, '\0', sizeof(sa));
+    sa.sa_handler = handler;    //信号处理函数中仅仅发送信号值，不做对应逻辑处理
+    if (restart)
+        sa.sa_flags |= SA_RESTART;
+        // 当执行某个阻塞系统调用(慢系统调用)时，收到信号都会返回-1，表示出错，结束进程，
+        // 如果启用SA_RESTART，则收到该信号时，进程不会返回，而是重新执行该系统调用。
+    sigfillset(&sa.sa_mask);        //信号处理函数执行期间屏蔽所有信号
+    assert(sigaction(sig, &sa, NULL) != -1);    //修改sig信号所关联的处理动作为sa内的内容，不关心oldact
+    /*int sigaction ( int signo,  *act,  *oldact) ;*/
+}
+
+//定时器回调函数，删除非活动连接在socket上的注册事件，并关闭
+void cb_func(client_data *user_data)
+{
+    assert(user_data);
+    int sockfd = user_data->sockfd;
+    user_data->timer = NULL;                // 定时器已经从时间轮取下，结点随连接对象一起放回
+    //连接还在工作线程手中时不能放回连接池，只做标记，最后交还的工作线程通知事件循环后由deal_close关闭
+    int *busy = &conns_slab->get(sockfd)->busy;
+    int old = __atomic_load_n(busy, __ATOMIC_ACQUIRE);
+    while (old)
+    {
+        if (__atomic_compare_exchange_n(busy, &old, old | CONN_CLOSING, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+            return;
+    }
+    epoll_ctl(user_data->epollfd, EPOLL_CTL_DEL, sockfd, 0);    // 删除所属epollfd中的注册
+    conns_slab->get(sockfd)->http.release();
+    conns_slab->release(sockfd);            // 先放回连接池再close，fd被复用时新连接拿到的是新对象
+    close(sockfd);                          // 关闭连接
+    __sync_fetch_and_sub(&http_conn::m_user_count, 1);  // 用户数-1
+}
+
+//过载时直接回复的响应，启动时就已拼好
+static const char overload_503[] =
+    "HTTP/1.1 503 Service Unavailable\r\n"
+    "Content-Length:0\r\n"
+    "Retry-After:1\r\n"
+    "Connection:close\r\n\r\n";
+
+void reject_conn(int connfd)
+{
+    //新连接的发送缓冲区是空的，非阻塞发送一次即可，不管是否成功都立刻关闭
+    send(connfd, overload_503, sizeof(overload_503) - 1, MSG_DONTWAIT | MSG_NOSIGNAL);
+    close(connfd);
+}
+
+int open_listenfd(const config &conf, bool reuseport)
+{
+    int listenfd = socket(PF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    assert(listenfd >= 0);
+
+    //struct linger tmp={1,0};
+    //SO_LINGER若有数据待发送，延迟关闭  
+    // 如果选择此选项，close或 shutdown将等到所有套接字里排队的消息成功发送或到达延迟时间后才会返回。否则，调用将立即返回。
+    //setsockopt(listenfd,SOL_SOCKET,SO_LINGER,&tmp,sizeof(tmp));
+
+    int ret = 0;
+    struct sockaddr_in address;
+    bzero(&address, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);    // ipv4:uint32_t    ipv6:uint8_t arr[16]
+    address.sin_port = htons(conf.port);            // uint16_t
+
+    int flag = 1;
+    setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof(flag));
+    //多个socket绑定同一端口，内核按四元组哈希把新连接分给各个监听socket
+    if (reuseport)
+        setsockopt(listenfd, SOL_SOCKET, SO_REUSEPORT, &flag, sizeof(flag));
+    ret = bind(listenfd, (struct sockaddr *)&address, sizeof(address));
+    // 把一个指定的端口分配给要bind的socket。 
+    // 以后就可以用这个端口来“听“网络的请求。bind()用于server端，端口分配后，其他socket不能再用这个端口。
+    // 相当于告诉client端“要请求服务，往这个端口发“。 client端不用bind，每建一个socket系统会分配一个临时的端口，用完后再释放。
+    assert(ret >= 0);
+    ret = listen(listenfd, conf.backlog);  //已完成三次握手、等待accept的连接队列长度，内核会截断到somaxconn
+    assert(ret >= 0);
+    return listenfd;
+}
+
+eventloop::eventloop() : m_id(0), m_epollfd(-1), m_listenfd(-1), m_own_listenfd(false), m_max_conn(MAX_FD), m_stop(false),
+                         m_timerfd(-1), m_armed(-1), m_sigfd(-1), m_stats_at(0), m_actor_model(0),
+                         m_conns(NULL), m_pool(NULL), m_notifyfd(-1)
+{
+}
+
+eventloop::~eventloop()
+{
+    close(m_epollfd);
+    if (m_own_listenfd)
+        close(m_listenfd);
+    close(m_timerfd);
+    if (m_sigfd >= 0)
+        close(m_sigfd);
+    close(m_notifyfd);
+}
+
+void eventloop::init(int id, const config &conf, int listenfd, conn_slab<conn_slot> *conns, threadpool<http_conn> *pool)
+{
+    m_id = id;
+    m_actor_model = conf.actor_model;
+    m_max_conn = conf.max_conn;
+    m_conns = conns;
+    conns_slab = conns;
+    m_pool = pool;
+    m_header_timeout = conf.header_timeout;
+    m_idle_timeout = conf.idle_timeout;
+    m_keepalive_timeout = conf.keepalive_timeout;
+
+    //创建内核事件表
+    m_epollfd = epoll_create(5);  // 生成一个epollfd，num是在epollfd上能关注的最大socketfd数
+    assert(m_epollfd != -1);
+
+    m_listenfd = listenfd;
+    if (conf.accept_mode == 0)
+    {
+        //每个事件循环独占自己的监听socket，多个事件循环时开启SO_REUSEPORT
+        m_listenfd = open_listenfd(conf, conf.reactor_num > 1);
+        m_own_listenfd = true;
+        //将listenfd放在epoll树上
+        addfd(m_epollfd, m_listenfd, false);
+    }
+    else if (m_listenfd >= 0)
+    {
+        //所有事件循环共享一个监听socket，EPOLLEXCLUSIVE保证一个新连接只唤醒一个循环
+        epoll_event event;
+        event.data.fd = m_listenfd;
+        event.events = EPOLLIN | EPOLLEXCLUSIVE;
+        epoll_ctl(m_epollfd, EPOLL_CTL_ADD, m_listenfd, &event);
+    }
+
+    //定时器到期由timerfd通知，每轮事件处理完后按最近的到期时间重新设置，精度为毫秒
+    m_timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    assert(m_timerfd >= 0);
+    addfd(m_epollfd, m_timerfd, false);
+    m_stats_at = monotonic_ms() + TIMESLOT * 1000;
+
+    //SIGTERM已经在main中屏蔽，由0号循环通过signalfd读取，不再有信号处理函数打断系统调用
+    if (m_id == 0)
+    {
+        sigset_t mask;
+        sigemptyset(&mask);
+        sigaddset(&mask, SIGTERM);
+        m_sigfd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+        assert(m_sigfd >= 0);
+        addfd(m_epollfd, m_sigfd, false);
+    }
+
+    //工作线程通过eventfd唤醒本循环
+    m_notifyfd = eventfd(0, EFD_CLOEXEC);
+    assert(m_notifyfd >= 0);
+    addfd(m_epollfd, m_notifyfd, false);
+}
+
+void *eventloop::worker(void *arg)
+{
+    eventloop *loop = (eventloop *)arg;
+    loop->loop();
+    return loop;
+}
+
+//运行在工作线程，epoll_ctl是线程安全的，重新注册事件可以直接modfd
+void eventloop::rearm_cb(void *owner, int sockfd, int ev)
+{
+    eventloop *loop = (eventloop *)owner;
+    //模拟Proactor下事件循环自己发送响应时也会调用，这时连接不在工作线程手中
+    if (pthread_equal(pthread_self(), loop->m_tid))
+    {
+        if (ev)
+            modfd(loop->m_epollfd, sockfd, ev);
+        else
+            loop->push_notify(sockfd, ev);
+        return;
+    }
+    int *busy = &loop->m_conns->get(sockfd)->busy;
+    //处理期间已经超时的连接不再注册事件
+    if (ev && !(__atomic_load_n(busy, __ATOMIC_ACQUIRE) & CONN_CLOSING))
+        modfd(loop->m_epollfd, sockfd, ev);
+    else
+        __atomic_fetch_or(busy, CONN_CLOSING, __ATOMIC_ACQ_REL);
+    //注册事件之后才交还，交还之前定时器不会关闭连接，fd不会被新连接复用
+    if (__atomic_sub_fetch(busy, 1, __ATOMIC_ACQ_REL) == CONN_CLOSING)
+        loop->push_notify(sockfd, 0);
+}
+
+void eventloop::push_notify(int sockfd, int ev)
+{
+    m_notify_lock.lock();
+    m_notify_list.push_back(std::make_pair(sockfd, ev));
+    m_notify_lock.unlock();
+    eventfd_write(m_notifyfd, 1);
+}
+
+void eventloop::stop()
+{
+    push_notify(-1, NOTIFY_STOP);
+}
+
+void eventloop::take_notify()
+{
+    m_notify_work.clear();
+    m_notify_lock.lock();
+    m_notify_work.swap(m_notify_list);
+    m_notify_lock.unlock();
+}
+
+//关闭工作线程交还的连接
+void eventloop::deal_notify()
+{
+    eventfd_t val;
+    eventfd_read(m_notifyfd, &val);
+    take_notify();
+    for (size_t i = 0; i < m_notify_work.size(); ++i)
+    {
+        int sockfd = m_notify_work[i].first;
+        if (m_notify_work[i].second == NOTIFY_STOP)
+            m_stop = true;
+        else if (m_notify_work[i].second == NOTIFY_ACCEPT)
+            add_conn(sockfd, user_timer(sockfd)->address, true);
+        else
+            deal_close(sockfd);
+    }
+}
+
+//运行在acceptor线程
+void eventloop::post_accept(int connfd, const sockaddr_in &client_address)
+{
+    //在acceptor线程分配对象，地址先写进client_data，事件循环在锁之后读取
+    if (!m_conns->alloc(connfd))
+    {
+        __sync_fetch_and_sub(&http_conn::m_user_count, 1);  // 归还acceptor占的名额
+        reject_conn(connfd);
+        return;
+    }
+    user_timer(connfd)->address = client_address;
+    push_notify(connfd, NOTIFY_ACCEPT);
+}
+
+//处理到期的定时器，0号循环每TIMESLOT秒打印一次统计信息
+void eventloop::timer_handler()
+{
+    m_timers.tick();
+    time_t now = monotonic_ms();
+    if (m_id == 0 && now >= m_stats_at)
+    {
+        m_stats_at = now + TIMESLOT * 1000;
+#ifdef ALLOC_STAT
+        //打印这个周期内的请求数和堆分配次数，只有make server_stat构建的版本统计分配
+        static unsigned long last_request = 0, last_alloc = 0;
+        unsigned long request = http_conn::m_request_count;
+        unsigned long alloc = alloc_count();
+        printf("[alloc stat] requests: %lu, heap allocs: %lu\n", request - last_request, alloc - last_alloc);
+        last_request = request;
+        last_alloc = alloc;
+#endif
+        //完整响应缓存这个周期内的命中和未命中次数
+        file_cache *cache = file_cache::GetInstance();
+        if (cache->enabled())
+        {
+            static unsigned long last_hit = 0, last_miss = 0;
+            unsigned long hit = cache->response_hits(), miss = cache->response_misses();
+            printf("[resp cache] hits: %lu, misses: %lu\n", hit - last_hit, miss - last_miss);
+            last_hit = hit;
+            last_miss = miss;
+        }
+        //各工作线程的排队数和处理数
+        m_pool->print_stats();
+    }
+}
+
+//若有数据传输，则按连接所处的阶段推迟定时器，并把定时器移到时间轮中新的槽
+//读事件：空闲的长连接收到数据说明开始了新请求，从此刻起计算请求头超时；
+//请求头还没收完时不推迟，慢速发送请求头的连接到期关闭。
+//写事件：响应发完后按长连接超时等待下一个请求，缓冲区中已有下一个请求的开头时按请求头超时。
+//接收消息体和发送响应时按空闲超时推迟
+void eventloop::adjust_timer(util_timer *timer, http_conn::PHASE phase, bool wrote)
+{
+    int timeout = m_idle_timeout;
+    if (phase == http_conn::PHASE_KEEPALIVE)
+        timeout = wrote ? m_keepalive_timeout : m_header_timeout;
+    else if (phase == http_conn::PHASE_HEADER)
+    {
+        if (!wrote)
+            return;
+        timeout = m_header_timeout;
+    }
+    timer->expire = monotonic_ms() + timeout;
+    m_timers.adjust_timer(timer);
+}
+
+//服务器端关闭连接，移除对应的定时器
+void eventloop::deal_close(int sockfd)
+{
+    //定时器已经超时关闭了该连接
+    if (!m_conns->get(sockfd))
+    {
+        return;
+    }
+    //还有工作线程持有连接时只做标记，最后交还的工作线程通知本循环后再关闭
+    int *busy = &m_conns->get(sockfd)->busy;
+    int old = __atomic_load_n(busy, __ATOMIC_ACQUIRE);
+    while (old & ~CONN_CLOSING)
+    {
+        if (__atomic_compare_exchange_n(busy, &old, old | CONN_CLOSING, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+            return;
+    }
+    *busy = 0;
+    util_timer *timer = user_timer(sockfd)->timer;
+    if (!timer)
+    {
+        //在工作线程手中时超时，定时器已经取下，交还后在这里关闭
+        cb_func(user_timer(sockfd));
+        return;
+    }
+    //定时器结点在连接对象中，要在回调把对象放回连接池之前取下
+    m_timers.del_timer(timer);
+    timer->cb_func(user_timer(sockfd));   // 回调函数就是：删除sockfd，关闭连接，用户数-1
+}
+
+//交还之前连接计为忙，定时器到期时只做标记。计数在入队之前，工作线程交还时一定能看到
+void eventloop::dispatch(int sockfd, int state)
+{
+    conn_slot *slot = m_conns->get(sockfd);
+    __atomic_fetch_add(&slot->busy, 1, __ATOMIC_ACQ_REL);
+    bool ok = state < 0 ? m_pool->append(&slot->http) : m_pool->append(&slot->http, state);
+    //队列满时请求被丢弃，连接留给定时器关闭
+    if (!ok && __atomic_sub_fetch(&slot->busy, 1, __ATOMIC_ACQ_REL) == CONN_CLOSING)
+        deal_close(sockfd);
+}
+
+//处理新到的客户连接
+void eventloop::deal_accept()
+{
+    struct sockaddr_in client_address;
+
+    while (1)
+    {
+        socklen_t client_addrlength = sizeof(client_address);
+        //accept4直接得到非阻塞、close-on-exec的连接，省去后续的fcntl
+        int connfd = accept4(m_listenfd, (struct sockaddr *)&client_address, &client_addrlength, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (connfd < 0)
+        {
+            if (errno != EAGAIN)
+                printf("accept error:errno is:%d\n", errno);
+            break;
+        }
+        //超出上限时不退出循环，把积压的连接全部取出，逐个回复503后关闭
+        if (connfd >= MAX_FD || http_conn::m_user_count >= m_max_conn)
+        {
+            reject_conn(connfd);
+            continue;
+        }
+        add_conn(connfd, client_address);
+    }
+}
+
+void eventloop::add_conn(int connfd, const sockaddr_in &client_address, bool reserved)
+{
+    //从连接池取出对象，池子申请不到内存时拒绝连接
+    if (!m_conns->alloc(connfd))
+    {
+        if (reserved)
+            __sync_fetch_and_sub(&http_conn::m_user_count, 1);
+        reject_conn(connfd);
+        return;
+    }
+    if (!reserved)
+        __sync_fetch_and_add(&http_conn::m_user_count, 1);
+    m_conns->get(connfd)->busy = 0;
+    user(connfd)->init(connfd, client_address, m_epollfd, this, rearm_cb);
+    init_timer(connfd, client_address, cb_func);
+}
+
+//初始化client_data数据
+//设置连接对象中的定时器，绑定回调函数、超时时间和用户数据，将定时器添加到时间轮中
+void eventloop::init_timer(int connfd, const sockaddr_in &client_address, void (*cb)(client_data *))
+{
+    user_timer(connfd)->address = client_address;
+    user_timer(connfd)->sockfd = connfd;        // client_data与http_conn在同一个conn_slot中
+    user_timer(connfd)->epollfd = m_epollfd;
+    util_timer *timer = &m_conns->get(connfd)->timer;     // 定时器结点在连接对象中，不用new
+    timer->user_data = user_timer(connfd);    // 绑定用户数据
+    timer->cb_func = cb;                        // 设置回调
+    timer->expire = monotonic_ms() + m_header_timeout;    // 新连接要在请求头超时之内发来请求
+    user_timer(connfd)->timer = timer;          // 绑定定时器
+    m_timers.add_timer(timer);                 // 添加到时间轮
+}
+
+//读出signalfd中的信号，SIGTERM让0号循环退出，main再通知其他循环
+void eventloop::deal_signal()
+{
+    struct signalfd_siginfo info;
+    while (read(m_sigfd, &info, sizeof(info)) == sizeof(info))
+    {
+        if (info.ssi_signo == SIGTERM)
+            m_stop = true;
+    }
+}
+
+void eventloop::deal_timer()
+{
+    uint64_t expirations;
+    read(m_timerfd, &expirations, sizeof(expirations));
+    m_armed = -1;
+    timer_handler();
+}
+
+void eventloop::arm_timer()
+{
+    time_t next = m_timers.next_expire();
+    if (m_id == 0 && (next < 0 || m_stats_at < next))
+        next = m_stats_at;
+    //已经设置的时间不晚于next时不用重设，提前醒来时tick什么也不做，之后再按新的时间设置
+    if (next < 0 || (m_armed >= 0 && m_armed <= next))
+        return;
+    struct itimerspec its;
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_sec = next / 1000;
+    its.it_value.tv_nsec = next % 1000 * 1000000;
+    //绝对时间已经过去时立即到期
+    timerfd_settime(m_timerfd, TFD_TIMER_ABSTIME, &its, NULL);
+    m_armed = next;
+}
+
+//处理客户连接上接收到的数据
+void eventloop::deal_read(int sockfd)
+{
+    util_timer *timer = user_timer(sockfd)->timer;
+    //交给工作线程之前取得阶段，之后连接由工作线程处理
+    http_conn::PHASE phase = user(sockfd)->phase();
+    //Reactor模式：只分发读事件，由工作线程读取并解析
+    if (1 == m_actor_model)
+    {
+        if (timer)
+            adjust_timer(timer, phase, false);
+        dispatch(sockfd, 0);
+        return;
+    }
+    //读入对应缓冲区
+    if (user(sockfd)->read_once())
+    {
+        if (timer)
+        {
+            adjust_timer(timer, phase, false);
+        }
+
+        //若监测到读事件，将该事件放入请求队列
+        dispatch(sockfd);
+    }
+    else // 读完了，关闭连接
+    {
+        deal_close(sockfd);
+    }
+}
+
+void eventloop::deal_write(int sockfd)
+{
+    util_timer *timer = user_timer(sockfd)->timer;
+    //Reactor模式：由工作线程发送
+    if (1 == m_actor_model)
+    {
+        if (timer)
+            adjust_timer(timer, http_conn::PHASE_WRITE, true);
+        dispatch(sockfd, 1);
+        return;
+    }
+    bool pending = false;
+    if (user(sockfd)->write(pending))
+    {
+        if (timer)
+        {
+            adjust_timer(timer, user(sockfd)->phase(), true);
+        }
+
+        //流水线的后续请求已经在读缓冲区里，直接交给工作线程解析
+        if (pending)
+            dispatch(sockfd);
+    }
+    else
+    {
+        deal_close(sockfd);
+    }
+}
+
+void eventloop::loop()
+{
+    m_tid = pthread_self();
+    while (!m_stop)
+    {
+        arm_timer();
+        //等待所监控文件描述符上有事件的产生
+        int number = epoll_wait(m_epollfd, m_events, MAX_EVENT_NUMBER, -1);
+        if (number < 0 && errno != EINTR)
+        {
+            printf("!!!!!epoll failure!!!!!");
+            break;
+        }
+        //对所有就绪事件进行处理
+        for (int i = 0; i < number; i++)
+        {
+            int sockfd = m_events[i].data.fd;
+
+            //处理新到的客户连接
+            if (sockfd == m_listenfd)
+            {
+                deal_accept();
+            }
+            //同一批事件中前面已经关闭的连接，以及等待工作线程交还后关闭的连接
+            else if (sockfd != m_timerfd && sockfd != m_sigfd && sockfd != m_notifyfd &&
+                     (!m_conns->get(sockfd) || (__atomic_load_n(&m_conns->get(sockfd)->busy, __ATOMIC_ACQUIRE) & CONN_CLOSING)))
+            {
+                continue;
+            }
+            //处理异常事件
+            else if (m_events[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+            {
+                deal_close(sockfd);
+            }
+            //定时器到期
+            else if (sockfd == m_timerfd)
+            {
+                deal_timer();
+            }
+            //SIGTERM
+            else if (sockfd == m_sigfd)
+            {
+                deal_signal();
+            }
+            //工作线程交还的连接
+            else if (sockfd == m_notifyfd)
+            {
+                deal_notify();
+            }
+            //处理客户连接上接收到的数据
+            else if (m_events[i].events & EPOLLIN)
+            {
+                deal_read(sockfd);
+            }
+            else if (m_events[i].events & EPOLLOUT)
+            {
+                deal_write(sockfd);
+            }
+        }
+    }
+}
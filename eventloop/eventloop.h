@@ -0,0 +1,133 @@
+﻿#ifndef EVENTLOOP_H
+#define EVENTLOOP_H
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/epoll.h>
+#include <pthread.h>
+#include <vector>
+
+#include "../config.h"
+#include "../threadpool/threadpool.h"
+#include "../timer/timing_wheel.h"
+#include "../http/http_conn.h"
+#include "../slab/conn_slab.h"
+
+#define MAX_FD 65536           //最大文件描述符
+#define MAX_EVENT_NUMBER 10000 //最大事件数
+#define TIMESLOT 5             //0号循环打印统计信息的周期，单位秒
+#define MAX_LOOPS 256          //最多的事件循环数量
+#define NOTIFY_ACCEPT -1       //acceptor线程交给事件循环的新连接
+#define NOTIFY_STOP -2         //让事件循环退出
+
+//conn_slot::busy的低位是持有连接的工作线程数，这一位表示连接要关闭，由最后一个交还的工作线程通知事件循环
+#define CONN_CLOSING 0x10000
+
+//每个连接的状态，从连接池按需分配
+//定时器结点也在其中，连接建立和关闭时不再单独申请和释放定时器
+struct conn_slot
+{
+    http_conn http;
+    client_data data;
+    util_timer timer;
+    int busy;           //在线程池队列中或正在处理的次数，加上CONN_CLOSING标志，原子地修改
+};
+
+// 事件循环(reactor)
+// 每个事件循环拥有独立的epollfd、监听socket、定时器和timerfd，
+// 只处理自己accept进来的连接；多个事件循环时监听socket开启SO_REUSEPORT，由内核在各循环间分发新连接。
+// 连接池以fd为下标，由所有事件循环共享，fd在进程内唯一，所以各循环访问的对象互不重叠。
+// 工作线程要关闭连接时通过eventfd交还给所属事件循环，定时器只在事件循环线程中修改。
+class eventloop
+{
+public:
+    eventloop();
+    virtual ~eventloop();
+
+    //创建内核事件表
+    //accept_mode为0时自己创建监听socket(多个事件循环时开启SO_REUSEPORT)，
+    //为2时在共享的listenfd上accept，为1时不监听，由acceptor线程通过post_accept交来新连接
+    virtual void init(int id, const config &conf, int listenfd, conn_slab<conn_slot> *conns, threadpool<http_conn> *pool);
+    //运行事件循环，0号循环直到收到SIGTERM，其余循环直到调用stop
+    virtual void loop();
+    //让事件循环退出，可以在其他线程调用
+    void stop();
+    //pthread_create的入口，arg为eventloop对象
+    static void *worker(void *arg);
+    //http_conn的rearm回调，运行在工作线程，ev为0表示关闭连接
+    static void rearm_cb(void *owner, int sockfd, int ev);
+    //acceptor线程把新连接交给本循环
+    void post_accept(int connfd, const sockaddr_in &client_address);
+
+protected:
+    http_conn *user(int fd)
+    {
+        return &m_conns->get(fd)->http;
+    }
+    client_data *user_timer(int fd)
+    {
+        return &m_conns->get(fd)->data;
+    }
+    //设置新连接的定时器并加入时间轮，cb为超时回调
+    void init_timer(int connfd, const sockaddr_in &client_address, void (*cb)(client_data *));
+    void deal_accept();
+    //初始化新连接并加入定时器，reserved表示acceptor已经为它把连接数加1
+    virtual void add_conn(int connfd, const sockaddr_in &client_address, bool reserved = false);
+    //读取signalfd，收到SIGTERM时退出
+    void deal_signal();
+    //timerfd到期，处理到期的定时器
+    void deal_timer();
+    //按最近一个定时器的到期时间设置timerfd，每轮事件处理完后调用
+    void arm_timer();
+    void deal_read(int sockfd);
+    void deal_write(int sockfd);
+    void deal_close(int sockfd);
+    void deal_notify();
+    //把连接交给工作线程，state为Reactor模式下的读写标志，-1表示模拟Proactor
+    void dispatch(int sockfd, int state = -1);
+    //有数据传输时按连接所处的阶段刷新定时器，读事件传入读之前的阶段，写事件传入写之后的阶段
+    void adjust_timer(util_timer *timer, http_conn::PHASE phase, bool wrote);
+    void timer_handler();
+    //工作线程把(sockfd, ev)交给本循环
+    void push_notify(int sockfd, int ev);
+    //事件循环取出全部待处理的(sockfd, ev)，放在m_notify_work中
+    void take_notify();
+
+protected:
+    int m_id;                   //事件循环编号，0号循环运行在主线程
+    int m_epollfd;
+    int m_listenfd;
+    bool m_own_listenfd;        //监听socket是否由本循环创建
+    int m_max_conn;             //连接数上限，超出后回复503
+    bool m_stop;
+    timing_wheel m_timers;      //本循环的定时器，分层时间轮
+    int m_timerfd;              //按最近一个定时器的到期时间设置的timerfd
+    time_t m_armed;             //timerfd设置的到期时间，没有设置时为-1
+    int m_sigfd;                //接收SIGTERM的signalfd，只有0号循环有
+    time_t m_stats_at;          //0号循环下一次打印统计信息的时间
+    int m_header_timeout;       //请求头超时，毫秒
+    int m_idle_timeout;         //空闲超时，毫秒
+    int m_keepalive_timeout;    //长连接超时，毫秒
+    epoll_event m_events[MAX_EVENT_NUMBER];
+    int m_actor_model;          //0:模拟Proactor 1:Reactor
+    pthread_t m_tid;            //运行本循环的线程
+
+    conn_slab<conn_slot> *m_conns;
+    threadpool<http_conn> *m_pool;
+
+    //工作线程交还的连接
+    int m_notifyfd;             //eventfd
+    locker m_notify_lock;
+    std::vector<std::pair<int, int> > m_notify_list;
+    std::vector<std::pair<int, int> > m_notify_work;
+};
+
+//设置信号函数
+void addsig(int sig, void(handler)(int), bool restart = true);
+//过载时回复预先拼好的503后关闭连接
+void reject_conn(int connfd);
+//创建非阻塞的监听socket，backlog取自配置
+int open_listenfd(const config &conf, bool reuseport);
+
+#endif
@@ -0,0 +1,427 @@
+﻿#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <poll.h>
+#include <cassert>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/eventfd.h>
+#include "uring_loop.h"
+
+//glibc没有封装io_uring的系统调用
+static int io_uring_setup(unsigned entries, io_uring_params *p)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+//user_data高32位存放SQE类型，低32位存放fd
+static inline unsigned long long make_data(int op, int fd)
+{
+    return ((unsigned long long)op << 32) | (unsigned)fd;
+}
+
+//超时回调：只shutdown，在途的recv随之以0返回，再由事件循环统一关闭
+static void uring_cb_func(client_data *user_data)
+{
+    shutdown(user_data->sockfd, SHUT_RDWR);
+    //tick()已经把定时器从时间轮取下
+    user_data->timer = NULL;
+}
+
+uring_loop::uring_loop() : m_ringfd(-1), m_sqes(NULL), m_sq_local_tail(0), m_sq_ptr(MAP_FAILED), m_cq_ptr(MAP_FAILED),
+                           m_multishot_accept(true), m_bufs(NULL), m_notify_val(0)
+{
+}
+
+uring_loop::~uring_loop()
+{
+    if (m_sqes)
+        munmap(m_sqes, m_sqes_size);
+    if (m_cq_ptr != MAP_FAILED && m_cq_ptr != m_sq_ptr)
+        munmap(m_cq_ptr, m_cq_size);
+    if (m_sq_ptr != MAP_FAILED)
+        munmap(m_sq_ptr, m_sq_size);
+    close(m_ringfd);
+    delete[] m_bufs;
+}
+
+void uring_loop::init(int id, const config &conf, int listenfd, conn_slab<conn_slot> *conns, threadpool<http_conn> *pool)
+{
+    eventloop::init(id, conf, listenfd, conns, pool);
+
+    io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    m_ringfd = io_uring_setup(URING_ENTRIES, &p);
+    if (m_ringfd < 0)
+    {
+        printf("io_uring_setup failed:errno is:%d\n", errno);
+        exit(1);
+    }
+
+    //映射提交队列、完成队列和SQE数组，新内核上两个队列共用一次映射
+    m_sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    m_cq_size = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if (m_cq_size > m_sq_size)
+            m_sq_size = m_cq_size;
+        m_cq_size = m_sq_size;
+    }
+    m_sq_ptr = mmap(0, m_sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ringfd, IORING_OFF_SQ_RING);
+    assert(m_sq_ptr != MAP_FAILED);
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+        m_cq_ptr = m_sq_ptr;
+    else
+    {
+        m_cq_ptr = mmap(0, m_cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ringfd, IORING_OFF_CQ_RING);
+        assert(m_cq_ptr != MAP_FAILED);
+    }
+    m_sqes_size = p.sq_entries * sizeof(io_uring_sqe);
+    m_sqes = (io_uring_sqe *)mmap(0, m_sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ringfd, IORING_OFF_SQES);
+    assert(m_sqes != MAP_FAILED);
+
+    char *sq = (char *)m_sq_ptr;
+    m_sq_head = (unsigned *)(sq + p.sq_off.head);
+    m_sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    m_sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    m_sq_array = (unsigned *)(sq + p.sq_off.array);
+    m_sq_local_tail = *m_sq_tail;
+    char *cq = (char *)m_cq_ptr;
+    m_cq_head = (unsigned *)(cq + p.cq_off.head);
+    m_cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    m_cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    m_cqes = (io_uring_cqe *)(cq + p.cq_off.cqes);
+
+    //接收缓冲区交给内核，recv完成时由内核挑选一块
+    m_bufs = new char[URING_BUF_NUM * http_conn::READ_BUFFER_SIZE];
+    prep_provide(0, URING_BUF_NUM);
+
+    //acceptor线程模式下本循环不监听
+    if (m_listenfd >= 0)
+        prep_accept();
+    prep_notify();
+    prep_timer();
+    if (m_sigfd >= 0)
+        prep_signal();
+}
+
+//取一个空闲SQE，队列满时先提交
+io_uring_sqe *uring_loop::get_sqe()
+{
+    unsigned head = __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE);
+    if (m_sq_local_tail - head > *m_sq_mask)
+    {
+        submit_and_wait(0);
+        head = __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE);
+    }
+    unsigned idx = m_sq_local_tail & *m_sq_mask;
+    io_uring_sqe *sqe = &m_sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    m_sq_array[idx] = idx;
+    ++m_sq_local_tail;
+    return sqe;
+}
+
+//一次系统调用提交攒下的全部SQE，并等待至少wait_nr个完成
+int uring_loop::submit_and_wait(int wait_nr)
+{
+    __atomic_store_n(m_sq_tail, m_sq_local_tail, __ATOMIC_RELEASE);
+    unsigned to_submit = m_sq_local_tail - __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE);
+    unsigned flags = wait_nr > 0 ? IORING_ENTER_GETEVENTS : 0;
+    if (to_submit == 0 && wait_nr == 0)
+        return 0;
+    return io_uring_enter(m_ringfd, to_submit, wait_nr, flags);
+}
+
+void uring_loop::prep_accept()
+{
+    io_uring_sqe *sqe = get_sqe();
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = m_listenfd;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    //一个SQE持续产生新连接的CQE
+    if (m_multishot_accept)
+        sqe->ioprio |= IORING_ACCEPT_MULTISHOT;
+    sqe->user_data = make_data(OP_ACCEPT, m_listenfd);
+}
+
+void uring_loop::prep_recv(int sockfd)
+{
+    io_uring_sqe *sqe = get_sqe();
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = sockfd;
+    sqe->len = http_conn::READ_BUFFER_SIZE;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BUF_GROUP;
+    sqe->user_data = make_data(OP_RECV, sockfd);
+}
+
+void uring_loop::prep_writev(int sockfd)
+{
+    int count = 0;
+    struct iovec *iv = user(sockfd)->get_iv(count);
+    io_uring_sqe *sqe = get_sqe();
+    sqe->opcode = IORING_OP_WRITEV;
+    sqe->fd = sockfd;
+    sqe->addr = (unsigned long long)iv;
+    sqe->len = count;
+    sqe->user_data = make_data(OP_WRITEV, sockfd);
+}
+
+void uring_loop::prep_close(int sockfd)
+{
+    io_uring_sqe *sqe = get_sqe();
+    sqe->opcode = IORING_OP_CLOSE;
+    sqe->fd = sockfd;
+    sqe->user_data = make_data(OP_CLOSE, sockfd);
+}
+
+//把从bid开始的count块缓冲区交还给内核
+void uring_loop::prep_provide(int bid, int count)
+{
+    io_uring_sqe *sqe = get_sqe();
+    sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+    sqe->fd = count;
+    sqe->addr = (unsigned long long)(m_bufs + bid * http_conn::READ_BUFFER_SIZE);
+    sqe->len = http_conn::READ_BUFFER_SIZE;
+    sqe->off = bid;
+    sqe->buf_group = URING_BUF_GROUP;
+    sqe->user_data = make_data(OP_PROVIDE, bid);
+}
+
+void uring_loop::prep_notify()
+{
+    io_uring_sqe *sqe = get_sqe();
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = m_notifyfd;
+    sqe->addr = (unsigned long long)&m_notify_val;
+    sqe->len = sizeof(m_notify_val);
+    sqe->user_data = make_data(OP_NOTIFY, m_notifyfd);
+}
+
+//signalfd可读后仍由eventloop::deal_signal读取
+void uring_loop::prep_signal()
+{
+    io_uring_sqe *sqe = get_sqe();
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = m_sigfd;
+    sqe->poll32_events = POLLIN;
+    sqe->user_data = make_data(OP_SIGNAL, m_sigfd);
+}
+
+//timerfd到期后由eventloop::deal_timer读取并处理定时器
+void uring_loop::prep_timer()
+{
+    io_uring_sqe *sqe = get_sqe();
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = m_timerfd;
+    sqe->poll32_events = POLLIN;
+    sqe->user_data = make_data(OP_TIMER, m_timerfd);
+}
+
+//运行在工作线程
+void uring_loop::rearm_cb(void *owner, int sockfd, int ev)
+{
+    uring_loop *loop = (uring_loop *)owner;
+    loop->push_notify(sockfd, ev);
+}
+
+void uring_loop::close_conn(int sockfd)
+{
+    util_timer *timer = user_timer(sockfd)->timer;
+    if (timer)
+    {
+        m_timers.del_timer(timer);
+        user_timer(sockfd)->timer = NULL;
+    }
+    prep_close(sockfd);
+    user(sockfd)->release();
+    m_conns->release(sockfd);
+    __sync_fetch_and_sub(&http_conn::m_user_count, 1);
+}
+
+void uring_loop::deal_accept(int res, unsigned flags)
+{
+    //内核不支持multishot时会返回EINVAL，退化为单次accept
+    if (res == -EINVAL && m_multishot_accept)
+    {
+        m_multishot_accept = false;
+        prep_accept();
+        return;
+    }
+    if (!(flags & IORING_CQE_F_MORE))
+        prep_accept();
+    if (res < 0)
+    {
+        printf("accept error:errno is:%d\n", -res);
+        return;
+    }
+    int connfd = res;
+    if (connfd >= MAX_FD || http_conn::m_user_count >= m_max_conn)
+    {
+        reject_conn(connfd);
+        return;
+    }
+    //multishot accept不回填对端地址
+    struct sockaddr_in client_address;
+    memset(&client_address, 0, sizeof(client_address));
+    add_conn(connfd, client_address);
+}
+
+void uring_loop::add_conn(int connfd, const sockaddr_in &client_address, bool reserved)
+{
+    if (!m_conns->alloc(connfd))
+    {
+        if (reserved)
+            __sync_fetch_and_sub(&http_conn::m_user_count, 1);
+        reject_conn(connfd);
+        return;
+    }
+    if (!reserved)
+        __sync_fetch_and_add(&http_conn::m_user_count, 1);
+    user(connfd)->init(connfd, client_address, -1, this, rearm_cb);
+    init_timer(connfd, client_address, uring_cb_func);
+    prep_recv(connfd);
+}
+
+void uring_loop::deal_recv(int sockfd, int res, unsigned flags)
+{
+    //缓冲区暂时用完，等本轮交还的缓冲区提交后重试
+    if (res == -ENOBUFS)
+    {
+        prep_recv(sockfd);
+        return;
+    }
+    bool ok = res > 0;
+    http_conn::PHASE phase = user(sockfd)->phase();
+    if (flags & IORING_CQE_F_BUFFER)
+    {
+        int bid = flags >> IORING_CQE_BUFFER_SHIFT;
+        if (ok)
+            ok = user(sockfd)->read_append(m_bufs + bid * http_conn::READ_BUFFER_SIZE, res);
+        prep_provide(bid, 1);
+    }
+    if (!ok)
+    {
+        close_conn(sockfd);
+        return;
+    }
+    util_timer *timer = user_timer(sockfd)->timer;
+    if (timer)
+        adjust_timer(timer, phase, false);
+    m_pool->append(user(sockfd));
+}
+
+void uring_loop::deal_writev(int sockfd, int res)
+{
+    if (res == -EAGAIN || res == -EINTR)
+    {
+        prep_writev(sockfd);
+        return;
+    }
+    bool done = false;
+    if (res < 0 || !user(sockfd)->write_complete(res, done))
+    {
+        close_conn(sockfd);
+        return;
+    }
+    util_timer *timer = user_timer(sockfd)->timer;
+    if (timer)
+        adjust_timer(timer, user(sockfd)->phase(), true);
+    //长连接发送完毕后等待下一个请求，流水线的后续请求已读入时直接交给工作线程，否则继续发送剩余部分
+    if (done && user(sockfd)->pending_request())
+        m_pool->append(user(sockfd));
+    else if (done)
+        prep_recv(sockfd);
+    else
+        prep_writev(sockfd);
+}
+
+void uring_loop::deal_notify()
+{
+    take_notify();
+    for (size_t i = 0; i < m_notify_work.size(); ++i)
+    {
+        int sockfd = m_notify_work[i].first;
+        int ev = m_notify_work[i].second;
+        if (ev == NOTIFY_STOP)
+            m_stop = true;
+        else if (ev == NOTIFY_ACCEPT)
+            add_conn(sockfd, user_timer(sockfd)->address, true);
+        else if (ev & EPOLLOUT)
+            prep_writev(sockfd);
+        else if (ev & EPOLLIN)
+            prep_recv(sockfd);
+        else
+            close_conn(sockfd);
+    }
+    prep_notify();
+}
+
+void uring_loop::handle_cqe(unsigned long long user_data, int res, unsigned flags)
+{
+    int op = (int)(user_data >> 32);
+    int fd = (int)(user_data & 0xffffffff);
+    switch (op)
+    {
+    case OP_ACCEPT:
+        deal_accept(res, flags);
+        break;
+    case OP_RECV:
+        deal_recv(fd, res, flags);
+        break;
+    case OP_WRITEV:
+        deal_writev(fd, res);
+        break;
+    case OP_NOTIFY:
+        deal_notify();
+        break;
+    case OP_SIGNAL:
+        deal_signal();
+        prep_signal();
+        break;
+    case OP_TIMER:
+        deal_timer();
+        prep_timer();
+        break;
+    default:
+        //close和provide buffers的完成不需要处理
+        break;
+    }
+}
+
+void uring_loop::loop()
+{
+    while (!m_stop)
+    {
+        arm_timer();
+        //提交本轮产生的全部SQE并等待完成
+        int ret = submit_and_wait(1);
+        if (ret < 0 && errno != EINTR)
+        {
+            printf("!!!!!io_uring_enter failure!!!!!");
+            break;
+        }
+        //处理所有完成事件
+        unsigned head = *m_cq_head;
+        unsigned tail = __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE);
+        while (head != tail)
+        {
+            io_uring_cqe *cqe = &m_cqes[head & *m_cq_mask];
+            unsigned long long user_data = cqe->user_data;
+            int res = cqe->res;
+            unsigned flags = cqe->flags;
+            ++head;
+            __atomic_store_n(m_cq_head, head, __ATOMIC_RELEASE);
+            handle_cqe(user_data, res, flags);
+            if (head == tail)
+                tail = __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE);
+        }
+    }
+}
@@ -0,0 +1,88 @@
+﻿#ifndef URING_LOOP_H
+#define URING_LOOP_H
+
+#include <linux/io_uring.h>
+#include "eventloop.h"
+
+#define URING_ENTRIES 4096      //提交队列长度
+#define URING_BUF_NUM 1024      //提供给内核的接收缓冲区个数
+#define URING_BUF_GROUP 0       //接收缓冲区组号
+
+// io_uring事件循环
+// 监听socket、定时器和timerfd、signalfd、工作线程交还连接用的eventfd沿用eventloop，
+// accept(multishot)、recv(内核提供缓冲区)、writev、close都以SQE的形式攒批后一次io_uring_enter提交，
+// 工作线程处理完请求后通过eventfd把连接交还给本循环，由本循环提交后续的SQE。
+// 每个连接同一时刻最多只有一个在途的SQE，所以只在该SQE完成后才关闭连接。
+class uring_loop : public eventloop
+{
+public:
+    uring_loop();
+    ~uring_loop();
+
+    //创建环形队列并注册接收缓冲区，其余参数同eventloop::init
+    void init(int id, const config &conf, int listenfd, conn_slab<conn_slot> *conns, threadpool<http_conn> *pool);
+    void loop();
+
+    //http_conn的rearm回调，运行在工作线程，ev为0表示关闭连接
+    static void rearm_cb(void *owner, int sockfd, int ev);
+
+private:
+    //SQE类型，与fd一起编码进user_data
+    enum URING_OP
+    {
+        OP_ACCEPT = 1,
+        OP_RECV,
+        OP_WRITEV,
+        OP_CLOSE,
+        OP_PROVIDE,
+        OP_NOTIFY,
+        OP_SIGNAL,
+        OP_TIMER
+    };
+
+    io_uring_sqe *get_sqe();
+    int submit_and_wait(int wait_nr);
+    void prep_accept();
+    void prep_recv(int sockfd);
+    void prep_writev(int sockfd);
+    void prep_close(int sockfd);
+    void prep_provide(int bid, int count);
+    void prep_notify();
+    void prep_signal();
+    void prep_timer();
+
+    void handle_cqe(unsigned long long user_data, int res, unsigned flags);
+    void deal_accept(int res, unsigned flags);
+    void add_conn(int connfd, const sockaddr_in &client_address, bool reserved = false);
+    void deal_recv(int sockfd, int res, unsigned flags);
+    void deal_writev(int sockfd, int res);
+    void deal_notify();
+    void close_conn(int sockfd);
+
+private:
+    int m_ringfd;
+    //提交队列
+    unsigned *m_sq_head;
+    unsigned *m_sq_tail;
+    unsigned *m_sq_mask;
+    unsigned *m_sq_array;
+    io_uring_sqe *m_sqes;
+    unsigned m_sq_local_tail;   //已填写但尚未对内核可见的尾部
+    //完成队列
+    unsigned *m_cq_head;
+    unsigned *m_cq_tail;
+    unsigned *m_cq_mask;
+    io_uring_cqe *m_cqes;
+    //mmap的区域，析构时释放
+    void *m_sq_ptr;
+    size_t m_sq_size;
+    void *m_cq_ptr;
+    size_t m_cq_size;
+    size_t m_sqes_size;
+
+    bool m_multishot_accept;    //内核不支持multishot accept时退化为每次重新提交
+    char *m_bufs;               //提供给内核的接收缓冲区
+    unsigned long long m_notify_val;    //eventfd的读缓冲
+};
+
+#endif
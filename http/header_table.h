@@ -0,0 +1,136 @@
+﻿#ifndef HEADER_TABLE_H
+#define HEADER_TABLE_H
+
+#include <string.h>
+#include "perfect_hash.h"
+
+//指向读缓冲区的一段，不拷贝；解析时已在末尾写入\0，data也可以当C字符串用
+struct str_slice
+{
+    const char *data;
+    int len;
+};
+
+// 请求头的名字到编号，用编译期构造的完美哈希查找
+namespace header
+{
+enum ID
+{
+    HOST = 0,
+    CONNECTION,
+    CONTENT_LENGTH,
+    CONTENT_TYPE,
+    TRANSFER_ENCODING,
+    EXPECT,
+    ACCEPT,
+    ACCEPT_ENCODING,
+    ACCEPT_LANGUAGE,
+    USER_AGENT,
+    REFERER,
+    ORIGIN,
+    COOKIE,
+    CACHE_CONTROL,
+    RANGE,
+    IF_RANGE,
+    IF_NONE_MATCH,
+    IF_MODIFIED_SINCE,
+    NUM_KNOWN,
+    UNKNOWN = -1
+};
+
+struct entry
+{
+    const char *key;
+};
+
+//顺序和ID一致
+constexpr entry names[] = {
+    {"Host"},
+    {"Connection"},
+    {"Content-Length"},
+    {"Content-Type"},
+    {"Transfer-Encoding"},
+    {"Expect"},
+    {"Accept"},
+    {"Accept-Encoding"},
+    {"Accept-Language"},
+    {"User-Agent"},
+    {"Referer"},
+    {"Origin"},
+    {"Cookie"},
+    {"Cache-Control"},
+    {"Range"},
+    {"If-Range"},
+    {"If-None-Match"},
+    {"If-Modified-Since"},
+};
+static_assert(sizeof(names) / sizeof(names[0]) == NUM_KNOWN, "header names out of sync with ID");
+
+constexpr int SLOTS = 64;
+constexpr phash::table<SLOTS> slots = phash::build<SLOTS>(names);
+static_assert(slots.seed != ~0u, "no perfect hash seed for the header table, enlarge SLOTS");
+
+inline ID lookup(const char *name, size_t len)
+{
+    return (ID)phash::find(slots, names, name, len);
+}
+}
+
+// 一个请求的全部请求头
+// 名字和值都是读缓冲区中的切片，已知的请求头另外按编号记下位置，处理时O(1)取得。
+// 读缓冲区扩大时旧段保留到请求结束，切片在整个请求期间有效。
+class header_table
+{
+public:
+    static const int MAX_HEADERS = 32;  //超过时按请求报文有误处理
+
+    void clear()
+    {
+        m_count = 0;
+        memset(m_known, 0, sizeof(m_known));
+    }
+    //记下一个请求头，id为UNKNOWN时只保存切片；重复的已知请求头以第一个为准
+    bool add(header::ID id, const char *name, int name_len, const char *value, int value_len)
+    {
+        if (m_count == MAX_HEADERS)
+            return false;
+        m_names[m_count].data = name;
+        m_names[m_count].len = name_len;
+        m_values[m_count].data = value;
+        m_values[m_count].len = value_len;
+        ++m_count;
+        if (id != header::UNKNOWN && !m_known[id])
+            m_known[id] = m_count;
+        return true;
+    }
+    //已知请求头的值，没有时返回NULL
+    const str_slice *get(header::ID id) const
+    {
+        return m_known[id] ? &m_values[m_known[id] - 1] : NULL;
+    }
+    const char *value(header::ID id) const
+    {
+        return m_known[id] ? m_values[m_known[id] - 1].data : NULL;
+    }
+    //按顺序访问所有请求头
+    int count() const
+    {
+        return m_count;
+    }
+    const str_slice &name(int i) const
+    {
+        return m_names[i];
+    }
+    const str_slice &value(int i) const
+    {
+        return m_values[i];
+    }
+
+private:
+    unsigned char m_known[header::NUM_KNOWN];   //已知请求头在数组中的下标加1，0表示没有
+    str_slice m_names[MAX_HEADERS];
+    str_slice m_values[MAX_HEADERS];
+    int m_count;
+};
+
+#endif
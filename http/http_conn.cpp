@@ -1,18 +1,34 @@
 ﻿#include "http_conn.h"
 #include <map>
+#include <sys/sendfile.h>
 #include <mysql/mysql.h>
 #include <fstream>
+#include <time.h>
 
-//定义http响应的一些状态信息
-const char *ok_200_title = "OK";
-const char *error_400_title = "Bad Request";
-const char *error_400_form = "Your request has bad syntax or is inherently impossible to staisfy.\n";
-const char *error_403_title = "Forbidden";
-const char *error_403_form = "You do not have permission to get file form this server.\n";
-const char *error_404_title = "Not Found";
-const char *error_404_form = "The requested file was not found on this server.\n";
-const char *error_500_title = "Internal Error";
-const char *error_500_form = "There was an unusual problem serving the request file.\n";
+//定义http响应的一些状态信息，状态行和错误页面预先生成，响应时直接复制
+#define STATUS_TEXT(line, form) {line, sizeof(line) - 1, form, sizeof(form) - 1}
+struct status_text
+{
+    const char *line;   //状态行，包括结尾的\r\n
+    int line_len;
+    const char *form;   //错误页面，成功的响应为空串
+    int form_len;
+};
+static const status_text ok_200 = STATUS_TEXT("HTTP/1.1 200 OK\r\n", "");
+static const status_text ok_206 = STATUS_TEXT("HTTP/1.1 206 Partial Content\r\n", "");
+static const status_text ok_304 = STATUS_TEXT("HTTP/1.1 304 Not Modified\r\n", "");
+static const status_text error_400 = STATUS_TEXT("HTTP/1.1 400 Bad Request\r\n",
+    "Your request has bad syntax or is inherently impossible to staisfy.\n");
+static const status_text error_403 = STATUS_TEXT("HTTP/1.1 403 Forbidden\r\n",
+    "You do not have permission to get file form this server.\n");
+static const status_text error_404 = STATUS_TEXT("HTTP/1.1 404 Not Found\r\n",
+    "The requested file was not found on this server.\n");
+static const status_text error_416 = STATUS_TEXT("HTTP/1.1 416 Range Not Satisfiable\r\n",
+    "The requested range is not satisfiable.\n");
+static const status_text error_500 = STATUS_TEXT("HTTP/1.1 500 Internal Error\r\n",
+    "There was an unusual problem serving the request file.\n");
+//字符串常量和它的长度
+#define LIT(s) s, (int)sizeof(s) - 1
 
 //当浏览器出现连接重置时，可能是网站根目录出错或http响应格式出错或者访问的文件中内容完全为空
 const char *doc_root = "/home/joe2/workspace1/S1mpleWebServer/root";
@@ -51,6 +67,13 @@ void http_conn::initmysql_result(connection_pool *connPool)
     }
 }
 
+void http_conn::init_precompress(int encodings)
+{
+    m_precompress = encodings;
+    if (encodings)
+        printf("precompressed %d files\n", precompress_dir(doc_root, encodings));
+}
+
 //对文件描述符设置非阻塞0
 int setnonblocking(int fd)
 {
@@ -61,7 +84,8 @@ int setnonblocking(int fd)
 }
 
 //将内核事件表注册读事件，ET模式，选择开启EPOLLONESHOT
-void addfd(int epollfd, int fd, bool one_shot)
+//fd须已是非阻塞的，accept4得到的连接就是这样
+void registerfd(int epollfd, int fd, bool one_shot)
 {
     epoll_event event;
     event.data.fd = fd;
@@ -69,6 +93,12 @@ void addfd(int epollfd, int fd, bool one_shot)
     if (one_shot)
         event.events |= EPOLLONESHOT;
     epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &event);
+}
+
+//注册读事件并设置非阻塞
+void addfd(int epollfd, int fd, bool one_shot)
+{
+    registerfd(epollfd, fd, one_shot);
     setnonblocking(fd);
 }
 
@@ -89,30 +119,47 @@ void modfd(int epollfd, int fd, int ev)
 }
 
 int http_conn::m_user_count = 0;
-int http_conn::m_epollfd = -1;
+unsigned long http_conn::m_request_count = 0;
+int http_conn::m_read_buf_max = 64 * 1024;
+bool http_conn::m_use_sendfile = false;
+int http_conn::m_precompress = 0;
 
 //关闭连接，关闭一个连接，客户总量减一
 void http_conn::close_conn(bool real_close)
 {
     if (real_close && (m_sockfd != -1))
     {
+        //交给所属事件循环关闭，由它删除定时器并更新连接数
+        //交还之后连接可能马上被事件循环放回连接池，要先改完自己的状态
+        if (m_rearm)
+        {
+            int sockfd = m_sockfd;
+            m_sockfd = -1;
+            m_rearm(m_owner, sockfd, 0);
+            return;
+        }
         removefd(m_epollfd, m_sockfd);
         m_sockfd = -1;
-        m_user_count--;
+        //多个事件循环和工作线程都会修改连接数
+        __sync_fetch_and_sub(&m_user_count, 1);
     }
 }
 
 //初始化连接,外部调用初始化套接字地址
-void http_conn::init(int sockfd, const sockaddr_in &addr)
+void http_conn::init(int sockfd, const sockaddr_in &addr, int epollfd,
+                     void *owner, void (*rearm)(void *owner, int sockfd, int ev))
 {
+    m_epollfd = epollfd;
+    m_owner = owner;
+    m_rearm = rearm;
     m_sockfd = sockfd;
     m_address = addr;
-    // 这里也要设置reuseaddr，以取消timewait状态
-    int reuse=1;
-    setsockopt(m_sockfd,SOL_SOCKET,SO_REUSEADDR,&reuse,sizeof(reuse));
+    //SO_REUSEADDR只对bind起作用，accept得到的连接不需要再设置
 
-    addfd(m_epollfd, sockfd, true);
-    m_user_count++;
+    //连接由accept4以SOCK_NONBLOCK创建，这里只注册事件
+    if (m_epollfd >= 0)
+        registerfd(m_epollfd, sockfd, true);
+    //连接数由事件循环在add_conn中增加，acceptor交来的连接已经在acceptor线程预先占了名额
     init();
 }
 
@@ -121,23 +168,59 @@ void http_conn::init(int sockfd, const sockaddr_in &addr)
 void http_conn::init()
 {
     mysql = NULL;
-    bytes_to_send = 0;
-    bytes_have_send = 0;
+    m_file_address = 0;
+    m_file_fd = -1;
+    m_file_entry = NULL;
+    m_keep_alive = false;
+    m_read_full = false;
+    //空闲的长连接不占用读缓冲区，下次读取时再从缓冲池申请
+    free_read_buf();
+    init_request();
+    init_write();
+}
+
+//为解析下一个请求重置状态，读缓冲区中流水线的后续请求保留
+void http_conn::init_request()
+{
     m_check_state = CHECK_STATE_REQUESTLINE;
     m_linger = false;
     m_method = GET;
     m_url = 0;
     m_version = 0;
-    m_content_length = 0;
+    m_content_length = -1;
+    m_chunked = false;
+    m_body_len = 0;
+    m_body_total = 0;
+    if (m_body_fd >= 0)
+    {
+        close(m_body_fd);
+        m_body_fd = -1;
+    }
     m_host = 0;
-    m_start_line = 0;
-    m_checked_idx = 0;
-    m_read_idx = 0;
-    m_write_idx = 0;
+    m_accept_enc = 0;
+    m_headers.clear();
+    m_content_encoding = NULL;
+    m_vary = false;
+    m_content_type = NULL;
+    m_accept_ranges = false;
+    m_validators = false;
+    m_partial = false;
     cgi = 0;
-    memset(m_read_buf, '\0', READ_BUFFER_SIZE);
-    memset(m_write_buf, '\0', WRITE_BUFFER_SIZE);
-    memset(m_real_file, '\0', FILENAME_LEN);
+    //m_real_file在do_request中拼接时总会以\0结尾，不需要清零
+}
+
+//响应队列全部发出后重置发送状态
+void http_conn::init_write()
+{
+    bytes_to_send = 0;
+    bytes_have_send = 0;
+    m_write_idx = 0;
+    m_resp_start = 0;
+    m_resp_count = 0;
+    m_iv_count = 0;
+    m_iv_idx = 0;
+    m_mapped_count = 0;
+    //m_write_buf按长度使用，不以\0结尾，不需要清零
 }
 
 //从状态机
@@ -148,59 +231,119 @@ void http_conn::init()
 //从状态机负责读取buffer中的数据，将每行数据末尾的\r\n置为\0\0，并更新从状态机在buffer中读取的位置m_checked_idx，以此来驱动主状态机解析。
 http_conn::LINE_STATUS http_conn::parse_line()
 {
-    char temp;
-    for (; m_checked_idx < m_read_idx; ++m_checked_idx)
+    //由scanner一次比较16或32字节，找到下一个\r或\n，m_checked_idx停在找到的位置，
+    //没有找到时停在m_read_idx，下次读入数据后从这里继续，已扫描过的字节不再比较
+    const char *end = m_read_buf + m_read_idx;
+    m_checked_idx = scanner::line_end(m_read_buf + m_checked_idx, end) - m_read_buf;
+    //并没有找到\r\n，需要继续接收
+    if (m_checked_idx == m_read_idx)
+        return LINE_OPEN;
+    //如果当前是\r字符，则有可能会读取到完整行
+    if (m_read_buf[m_checked_idx] == '\r')
     {
-        //temp为将要分析的字节
-        temp = m_read_buf[m_checked_idx];
-        //如果当前是\r字符，则有可能会读取到完整行
-        if (temp == '\r')
+        //下一个字符达到了buffer结尾，则接收不完整，需要继续接收
+        if ((m_checked_idx + 1) == m_read_idx)
+            return LINE_OPEN;
+        //下一个字符是\n，将\r\n改为\0\0
+        else if (m_read_buf[m_checked_idx + 1] == '\n')
         {
-            //下一个字符达到了buffer结尾，则接收不完整，需要继续接收
-            if ((m_checked_idx + 1) == m_read_idx)
-                return LINE_OPEN;
-            //下一个字符是\n，将\r\n改为\0\0
-            else if (m_read_buf[m_checked_idx + 1] == '\n')
-            {
-                m_read_buf[m_checked_idx++] = '\0';
-                m_read_buf[m_checked_idx++] = '\0';
-                return LINE_OK;
-            }
-            //如果都不符合，则返回语法错误
-            return LINE_BAD;
-        }
-        //如果当前字符是\n，也有可能读取到完整行
-        //一般是上次读取到\r就到buffer末尾了，没有接收完整，再次接收时会出现这种情况
-        else if (temp == '\n')  
-        {
-            //前一个字符是\r，则接收完整
-            if (m_checked_idx > 1 && m_read_buf[m_checked_idx - 1] == '\r')
-            {
-                m_read_buf[m_checked_idx - 1] = '\0';
-                m_read_buf[m_checked_idx++] = '\0';
-                return LINE_OK;
-            }
-            return LINE_BAD;
+            m_line_end = m_checked_idx;
+            m_read_buf[m_checked_idx++] = '\0';
+            m_read_buf[m_checked_idx++] = '\0';
+            return LINE_OK;
         }
+        //如果都不符合，则返回语法错误
+        return LINE_BAD;
     }
-    //并没有找到\r\n，需要继续接收
-    return LINE_OPEN;
+    //如果当前字符是\n，也有可能读取到完整行
+    //一般是上次读取到\r就到buffer末尾了，没有接收完整，再次接收时会出现这种情况
+    //前一个字符是\r，则接收完整
+    if (m_checked_idx > 1 && m_read_buf[m_checked_idx - 1] == '\r')
+    {
+        m_line_end = m_checked_idx - 1;
+        m_read_buf[m_checked_idx - 1] = '\0';
+        m_read_buf[m_checked_idx++] = '\0';
+        return LINE_OK;
+    }
+    return LINE_BAD;
+}
+
+void http_conn::free_read_buf()
+{
+    buf_pool::free_chain(m_read_head);
+    m_read_head = NULL;
+    m_read_buf = NULL;
+    m_read_size = 0;
+    m_read_total = 0;
+    m_start_line = 0;
+    m_checked_idx = 0;
+    m_read_idx = 0;
+}
+
+//当前段写满时申请一个更大的段，把还没解析完的部分(不完整的行或消息体)搬过去，
+//使解析始终在一个连续的段内进行。旧段里的m_url、m_host等指针仍然有效，
+//只有还在解析请求行时旧段里没有被引用的数据，可以直接释放。
+bool http_conn::grow_read_buf()
+{
+    int pending = m_read_idx - m_start_line;
+    int need = pending * 2;
+    //留在内存中的消息体要整个放在一个段里，末尾还要写\0；写入临时文件的消息体不需要
+    if (m_check_state == CHECK_STATE_CONTENT && !m_chunked && m_content_length <= body_mem_max() &&
+        need < m_content_length + 1)
+        need = m_content_length + 1;
+    if (need < READ_BUFFER_SIZE)
+        need = READ_BUFFER_SIZE;
+
+    bool keep_old = m_read_head && m_check_state != CHECK_STATE_REQUESTLINE;
+    int total = (keep_old ? m_read_total : 0) + buf_pool::round_up(need);
+    if (total > m_read_buf_max)
+        return false;
+    buf_seg *seg = buf_pool::alloc(need);
+    if (!seg)
+        return false;
+
+    if (pending > 0)
+        memcpy(seg->data(), m_read_buf + m_start_line, pending);
+    if (keep_old)
+    {
+        seg->next = m_read_head;
+    }
+    else
+    {
+        free_read_buf();
+    }
+    m_read_head = seg;
+    m_read_buf = seg->data();
+    m_read_size = seg->size;
+    m_read_total = total;
+    m_checked_idx -= m_start_line;
+    m_read_idx = pending;
+    m_start_line = 0;
+    m_read_buf[m_read_idx] = '\0';
+    return true;
 }
 
 //循环读取客户数据，直到无数据可读或对方关闭连接
 //非阻塞ET工作模式下，需要一次性将数据读完
 bool http_conn::read_once()
 {
-    if (m_read_idx >= READ_BUFFER_SIZE)
-    {
-        return false;
-    }
     int bytes_read = 0;
 
     while (true)
     {
+        //段写满时换更大的段，末尾留一个字节放\0
+        if (m_read_idx + 1 >= m_read_size && !grow_read_buf())
+        {
+            //到了上限时先交给process解析，消息体会被解码移走或写入临时文件；
+            //处理之后仍然没有空间说明请求头过大，失败。socket中剩下的数据在重新注册读事件后再读
+            if (m_read_full)
+                return false;
+            m_read_full = true;
+            return true;
+        }
+        m_read_full = false;
         //从套接字接收数据，存储在m_read_buf缓冲区
-        bytes_read = recv(m_sockfd, m_read_buf + m_read_idx, READ_BUFFER_SIZE - m_read_idx, 0);
+        bytes_read = recv(m_sockfd, m_read_buf + m_read_idx, m_read_size - 1 - m_read_idx, 0);
         if (bytes_read == -1)
         {
             //非阻塞ET模式下，需要一次性将数据读完
@@ -214,7 +357,27 @@ bool http_conn::read_once()
         }
         //修改m_read_idx的读取字节数
         m_read_idx += bytes_read;
+        m_read_buf[m_read_idx] = '\0';
+    }
+    return true;
+}
+
+//io_uring后端的recv已经由内核完成，这里只把数据拷进读缓冲区
+bool http_conn::read_append(const char *data, int len)
+{
+    while (len > 0)
+    {
+        if (m_read_idx + 1 >= m_read_size && !grow_read_buf())
+            return false;
+        int n = m_read_size - 1 - m_read_idx;
+        if (n > len)
+            n = len;
+        memcpy(m_read_buf + m_read_idx, data, n);
+        m_read_idx += n;
+        data += n;
+        len -= n;
     }
+    m_read_buf[m_read_idx] = '\0';
     return true;
 }
 
@@ -222,10 +385,11 @@ bool http_conn::read_once()
 http_conn::HTTP_CODE http_conn::parse_request_line(char *text)
 {
     //在HTTP报文中，请求行用来说明请求类型,要访问的资源以及所使用的HTTP版本，其中各个部分之间通过\t或空格分隔。
-    //请求行中最先含有空格和\t任一字符的位置并返回
-    m_url = strpbrk(text, " \t");   // 检索str1中第一个匹配str2字符串的字符位置，返回char* 字符位置。
+    //请求行中最先含有空格和\t任一字符的位置并返回，行的长度已知，由scanner按向量扫描
+    char *end = m_read_buf + m_line_end;
+    m_url = (char *)scanner::space(text, end);
     //如果没有空格或\t，则报文格式有误
-    if (!m_url)
+    if (m_url == end)
     {
         return BAD_REQUEST;
     }
@@ -250,8 +414,8 @@ http_conn::HTTP_CODE http_conn::parse_request_line(char *text)
     m_url += strspn(m_url, " \t");  //返回str1中第一个不在字符串str2中出现的字符下标。
 
     //使用与判断请求方式的相同逻辑，判断HTTP版本号
-    m_version = strpbrk(m_url, " \t");
-    if (!m_version)
+    m_version = (char *)scanner::space(m_url, end);
+    if (m_version == end)
         return BAD_REQUEST;
     *m_version++ = '\0';
     m_version += strspn(m_version, " \t");
@@ -283,6 +447,18 @@ http_conn::HTTP_CODE http_conn::parse_request_line(char *text)
     return NO_REQUEST;
 }
 
+//解析Content-Length的值，不是纯数字、溢出或超过BODY_MAX时返回-1
+static long long parse_content_length(const char *value)
+{
+    if (*value == '\0' || value[strspn(value, "0123456789")] != '\0')
+        return -1;
+    errno = 0;
+    long long len = strtoll(value, NULL, 10);
+    if (errno == ERANGE || len > http_conn::BODY_MAX)
+        return -1;
+    return len;
+}
+
 //解析http请求的一个头部信息
 http_conn::HTTP_CODE http_conn::parse_headers(char *text)
 {
@@ -290,65 +466,214 @@ http_conn::HTTP_CODE http_conn::parse_headers(char *text)
     if (text[0] == '\0')
     {
         //判断是GET还是POST请求
-        if (m_content_length != 0)
+        //Content-Length和chunked同时出现时消息体边界有歧义，直接拒绝，防止请求走私
+        if (m_chunked && m_content_length >= 0)
+            return BAD_REQUEST;
+        if (m_chunked || m_content_length > 0)
         {
             //POST需要跳转到消息体处理状态
-            printf("judge->POST\n");
             m_check_state = CHECK_STATE_CONTENT;
+            m_body_state = m_chunked ? BODY_CHUNK_SIZE : BODY_DATA;
+            m_body_remaining = m_content_length;
             return NO_REQUEST;
         }
-        printf("judge->GET\n");
         return GET_REQUEST;
     }
-    //解析请求头部连接字段
-    else if (strncasecmp(text, "Connection:", 11) == 0)
+    //名字到冒号为止，值去掉两端的空白，名字和值的结尾都写入\0，切片可以直接当C字符串用
+    char *end = m_read_buf + m_line_end;
+    char *colon = (char *)memchr(text, ':', end - text);
+    //没有冒号、名字为空或名字和冒号之间有空白都是语法错误
+    if (!colon || colon == text || colon[-1] == ' ' || colon[-1] == '\t')
+        return BAD_REQUEST;
+    int name_len = colon - text;
+    *colon = '\0';
+    char *value = colon + 1;
+    value += strspn(value, " \t");
+    while (end > value && (end[-1] == ' ' || end[-1] == '\t'))
+        --end;
+    *end = '\0';
+
+    //已知的请求头由完美哈希得到编号，所有请求头都记进m_headers，之后按编号O(1)取值
+    header::ID id = header::lookup(text, name_len);
+    if (!m_headers.add(id, text, name_len, value, end - value))
+        return BAD_REQUEST;
+    switch (id)
     {
-        printf("parse connection\n");
-        text += 11;
-        //跳过空格和\t字符
-        text += strspn(text, " \t");
-        if (strcasecmp(text, "keep-alive") == 0)
-        {
-            //如果是长连接，则将linger标志设置为true
+    //解析请求头部连接字段
+    case header::CONNECTION:
+        //如果是长连接，则将linger标志设置为true
+        if (strcasecmp(value, "keep-alive") == 0)
             m_linger = true;
-        }
-    }
+        break;
     //解析请求头部内容长度字段
-    else if (strncasecmp(text, "Content-length:", 15) == 0)
+    //只接受十进制数字，溢出或超过BODY_MAX都拒绝；重复出现时值必须相同
+    case header::CONTENT_LENGTH:
     {
-        printf("parse Content-length\n");
-        text += 15;
-        text += strspn(text, " \t");
-        m_content_length = atol(text);
+        long long len = parse_content_length(value);
+        if (len < 0 || (m_content_length >= 0 && m_content_length != len))
+            return BAD_REQUEST;
+        m_content_length = len;
+        break;
     }
+    //只支持chunked一种传输编码
+    case header::TRANSFER_ENCODING:
+        if (strcasecmp(value, "chunked") != 0)
+            return BAD_REQUEST;
+        m_chunked = true;
+        break;
     //解析请求头部HOST字段
-    else if (strncasecmp(text, "Host:", 5) == 0)
+    case header::HOST:
+        m_host = value;
+        break;
+    //解析请求头部Accept-Encoding字段，决定能否发送预压缩的文件
+    case header::ACCEPT_ENCODING:
+        m_accept_enc = parse_accept_encoding(value);
+        break;
+    //Range和条件请求的验证器在do_request中确定文件后再从m_headers取出，其余的请求头不需要解析
+    default:
+        break;
+    }
+    return NO_REQUEST;
+}
+
+int http_conn::body_mem_max()
+{
+    return BODY_MEM_MAX < m_read_buf_max / 2 ? BODY_MEM_MAX : m_read_buf_max / 2;
+}
+
+bool http_conn::append_body(const char *data, int n)
+{
+    m_body_total += n;
+    if (m_body_total > BODY_MAX)
+        return false;
+    //放得下时留在读缓冲区，解码后的数据不会比原始数据长，向前移动不会覆盖没处理的数据
+    if (m_body_fd < 0 && m_body_len + n <= body_mem_max())
     {
-        printf("parse host\n");
-        text += 5;
-        text += strspn(text, " \t");
-        m_host = text;
+        memmove(m_read_buf + m_start_line + m_body_len, data, n);
+        m_body_len += n;
+        return true;
     }
-    else
+    //超过内存上限，连同已经留在缓冲区中的部分一起写入临时文件
+    if (m_body_fd < 0)
     {
-        // 有些关于浏览器的头部字段因为没有用到，所以不需要解析
-        printf("oop!unknow header: %s\n",text);
+        //O_TMPFILE的文件没有名字，关闭后自动删除；文件系统不支持时用mkstemp后立即unlink
+        m_body_fd = open("/tmp", O_TMPFILE | O_RDWR, 0600);
+        if (m_body_fd < 0)
+        {
+            char tmpl[] = "/tmp/http_body_XXXXXX";
+            m_body_fd = mkstemp(tmpl);
+            if (m_body_fd < 0)
+                return false;
+            unlink(tmpl);
+        }
+        if (m_body_len > 0 && ::write(m_body_fd, m_read_buf + m_start_line, m_body_len) != m_body_len)
+            return false;
+        m_body_len = 0;
     }
-    return NO_REQUEST;
+    return ::write(m_body_fd, data, n) == n;
 }
 
-//判断http请求是否被完整读入
-http_conn::HTTP_CODE http_conn::parse_content(char *text)
+//消息体可能大于读缓冲区，也可能是chunked编码，不能等整个消息体读入后再处理。
+//每次只处理[m_checked_idx, m_read_idx)中新到的数据：解码出的数据紧接着放在m_start_line之后，
+//超过内存上限就写入临时文件，剩下不完整的部分移到解码数据之后，读缓冲区不会随消息体增长
+http_conn::HTTP_CODE http_conn::parse_content()
 {
-    //判断buffer中是否读取了消息体
-    if (m_read_idx >= (m_content_length + m_checked_idx))
+    char *p = m_read_buf + m_checked_idx;
+    char *end = m_read_buf + m_read_idx;
+    bool more = true;
+    while (more && m_body_state != BODY_DONE)
     {
-        text[m_content_length] = '\0';
-        //POST请求中最后为输入的用户名和密码
-        m_string = text;
-        return GET_REQUEST;
+        switch (m_body_state)
+        {
+        case BODY_DATA:
+        {
+            long n = end - p < m_body_remaining ? end - p : m_body_remaining;
+            if (n > 0 && !append_body(p, n))
+                return BAD_REQUEST;
+            p += n;
+            m_body_remaining -= n;
+            if (m_body_remaining > 0)
+                more = false;
+            else
+                m_body_state = m_chunked ? BODY_CHUNK_CRLF : BODY_DONE;
+            break;
+        }
+        case BODY_CHUNK_SIZE:
+        {
+            //块大小是十六进制，后面可以跟;开头的扩展，整行以\r\n结束
+            char *nl = (char *)memchr(p, '\n', end - p);
+            if (!nl)
+            {
+                if (end - p > CHUNK_LINE_MAX)
+                    return BAD_REQUEST;
+                more = false;
+                break;
+            }
+            if (nl == p || nl[-1] != '\r')
+                return BAD_REQUEST;
+            long size = 0;
+            char *q = p;
+            for (; q < nl - 1 && isxdigit((unsigned char)*q); ++q)
+            {
+                if (size > BODY_MAX)
+                    return BAD_REQUEST;
+                size = size * 16 + (isdigit((unsigned char)*q) ? *q - '0' : (*q | 0x20) - 'a' + 10);
+            }
+            if (q == p || (q < nl - 1 && *q != ';' && *q != ' ' && *q != '\t'))
+                return BAD_REQUEST;
+            p = nl + 1;
+            m_body_remaining = size;
+            m_body_state = size == 0 ? BODY_TRAILER : BODY_DATA;
+            break;
+        }
+        case BODY_CHUNK_CRLF:
+        {
+            if (end - p < 2)
+            {
+                more = false;
+                break;
+            }
+            if (p[0] != '\r' || p[1] != '\n')
+                return BAD_REQUEST;
+            p += 2;
+            m_body_state = BODY_CHUNK_SIZE;
+            break;
+        }
+        case BODY_TRAILER:
+        {
+            //trailer中的字段不使用，逐行跳过直到空行
+            char *nl = (char *)memchr(p, '\n', end - p);
+            if (!nl)
+            {
+                if (end - p > CHUNK_LINE_MAX)
+                    return BAD_REQUEST;
+                more = false;
+                break;
+            }
+            if (nl == p || nl[-1] != '\r')
+                return BAD_REQUEST;
+            if (nl == p + 1)
+                m_body_state = BODY_DONE;
+            p = nl + 1;
+            break;
+        }
+        default:
+            return INTERNAL_ERROR;
+        }
     }
-    return NO_REQUEST;
+
+    //没处理完的数据(不完整的块大小行、下一个流水线请求)移到解码数据之后
+    int body_end = m_start_line + m_body_len;
+    int rest = end - p;
+    memmove(m_read_buf + body_end, p, rest);
+    m_checked_idx = body_end;
+    m_read_idx = body_end + rest;
+    m_read_buf[m_read_idx] = '\0';
+    if (m_body_state != BODY_DONE)
+        return NO_REQUEST;
+    //留在内存中的消息体从m_start_line开始，m_checked_idx停在下一个请求的起点
+    m_string = m_read_buf + m_start_line;
+    return GET_REQUEST;
 }
 
 // 主状态机
@@ -368,15 +693,24 @@ http_conn::HTTP_CODE http_conn::process_read()
     /*
     解析完消息体后，报文的完整解析就完成了，但此时主状态机的状态还是CHECK_STATE_CONTENT，
     也就是说，符合循环入口条件，还会再次进入循环，这并不是我们所希望的。
-    为此，增加了该语句，并在完成消息体解析后，将line_status变量更改为LINE_OPEN，此时可以跳出循环，完成报文解析任务。
+    为此，增加了该语句。现在解析消息体的分支总是直接返回，不会再回到循环条件。
     */
     while ((m_check_state == CHECK_STATE_CONTENT && line_status == LINE_OK) || ((line_status = parse_line()) == LINE_OK))
     {
+        //消息体不按行解析，m_start_line保持在消息体的起点
+        //不能调用parse_line，它会把消息体当成行扫描，移动m_checked_idx并改写其中的\r\n
+        if (m_check_state == CHECK_STATE_CONTENT)
+        {
+            ret = parse_content();
+            //完整解析POST请求后，跳转到报文响应函数；消息体还没收完时返回等待后续数据
+            if (ret == GET_REQUEST)
+                return do_request();
+            return ret;
+        }
         text = get_line();
         //m_start_line是每一个数据行在m_read_buf中的起始位置
         //m_checked_idx表示从状态机在m_read_buf中读取的位置
         m_start_line = m_checked_idx;
-        printf("m_state_TEXT: \"%s\"\n", text);
         //主状态机的三种状态转移逻辑
         switch (m_check_state)
         {
@@ -401,17 +735,6 @@ http_conn::HTTP_CODE http_conn::process_read()
             }
             break;
         }
-        case CHECK_STATE_CONTENT:
-        {
-            //解析消息体
-            ret = parse_content(text);
-            //完整解析POST请求后，跳转到报文响应函数
-            if (ret == GET_REQUEST)
-                return do_request();
-            //解析完消息体即完成报文解析，避免再次进入循环，更新line_status
-            line_status = LINE_OPEN;
-            break;
-        }
         default:
             return INTERNAL_ERROR;
         }
@@ -424,7 +747,6 @@ http_conn::HTTP_CODE http_conn::do_request()
     //将初始化的m_real_file赋值为网站根目录
     strcpy(m_real_file, doc_root);
     int len = strlen(doc_root);
-    printf("\t\tm_url:%s\n", m_url);
     //找到m_url中/的位置
     const char *p = strrchr(m_url, '/');    //该函数返回str中最后一次出现字符c的位置。如果未找到该值，则函数返回一个空指针。
 
@@ -435,23 +757,33 @@ http_conn::HTTP_CODE http_conn::do_request()
         //根据标志判断是登录检测还是注册检测
         char flag = m_url[1];
 
-        char *m_url_real = (char *)malloc(sizeof(char) * 200);
-        strcpy(m_url_real, "/");
-        strcat(m_url_real, m_url + 2);
-        strncpy(m_real_file + len, m_url_real, FILENAME_LEN - len - 1);
-        free(m_url_real);
+        //去掉标志位，直接拼接到m_real_file
+        snprintf(m_real_file + len, FILENAME_LEN - len, "/%s", m_url + 2);
 
         //将用户名和密码提取出来
         //user=123&passwd=123
+        //消息体可能写入了临时文件，只需要开头的一段；超长的用户名和密码截断，不能写出数组
+        const char *body = m_string;
+        int body_len = m_body_len;
+        char spooled[256];
+        if (m_body_fd >= 0)
+        {
+            body_len = pread(m_body_fd, spooled, sizeof(spooled), 0);
+            if (body_len < 0)
+                body_len = 0;
+            body = spooled;
+        }
         char name[100], password[100];
-        int i;
-        for (i = 5; m_string[i] != '&'; ++i)
-            name[i - 5] = m_string[i];
-        name[i - 5] = '\0';
-
-        int j = 0;
-        for (i = i + 10; m_string[i] != '\0'; ++i, ++j)
-            password[j] = m_string[i];
+        int i, j = 0;
+        for (i = 5; i < body_len && body[i] != '&'; ++i)
+            if (j < (int)sizeof(name) - 1)
+                name[j++] = body[i];
+        name[j] = '\0';
+
+        j = 0;
+        for (i = i + 10; i < body_len; ++i)
+            if (j < (int)sizeof(password) - 1)
+                password[j++] = body[i];
         password[j] = '\0';
 
         //同步线程登录校验
@@ -459,7 +791,7 @@ http_conn::HTTP_CODE http_conn::do_request()
         {
             //如果是注册，先检测数据库中是否有重名的
             //没有重名的，进行增加数据
-            char *sql_insert = (char *)malloc(sizeof(char) * 200);
+            char sql_insert[300];
             strcpy(sql_insert, "INSERT INTO user(username, passwd) VALUES(");
             strcat(sql_insert, "'");
             strcat(sql_insert, name);
@@ -495,49 +827,41 @@ http_conn::HTTP_CODE http_conn::do_request()
     }
 
     //如果请求资源为/0，表示跳转注册界面
+    //拼接只写入用到的字节并以\0结尾，不需要临时缓冲区
     if (*(p + 1) == '0')
     {
-        char *m_url_real = (char *)malloc(sizeof(char) * 200);
-        strcpy(m_url_real, "/register.html");
         //将网站目录和/register.html进行拼接，更新到m_real_file中
-        strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
-
-        free(m_url_real);
+        snprintf(m_real_file + len, FILENAME_LEN - len, "%s", "/register.html");
     }
     //如果请求资源为/1，表示跳转登录界面
     else if (*(p + 1) == '1')
     {
-        char *m_url_real = (char *)malloc(sizeof(char) * 200);
-        strcpy(m_url_real, "/log.html");
         //将网站目录和/log.html进行拼接，更新到m_real_file中
-        strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
-
-        free(m_url_real);
+        snprintf(m_real_file + len, FILENAME_LEN - len, "%s", "/log.html");
     }
     else if (*(p + 1) == '5')
     {
-        char *m_url_real = (char *)malloc(sizeof(char) * 200);
-        strcpy(m_url_real, "/picture.html");
-        strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
-
-        free(m_url_real);
+        snprintf(m_real_file + len, FILENAME_LEN - len, "%s", "/picture.html");
     }
     else if (*(p + 1) == '6')
     {
-        char *m_url_real = (char *)malloc(sizeof(char) * 200);
-        strcpy(m_url_real, "/video.html");
-        strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
-
-        free(m_url_real);
+        snprintf(m_real_file + len, FILENAME_LEN - len, "%s", "/video.html");
     }
     else
         //如果以上均不符合，即不是登录和注册，直接将url与网站目录拼接
         //这里的情况是welcome界面，请求服务器上的一个图片
-        strncpy(m_real_file + len, m_url, FILENAME_LEN - len - 1);
+        snprintf(m_real_file + len, FILENAME_LEN - len, "%s", m_url);
 
     //通过stat获取请求资源文件信息，成功则将信息更新到m_file_stat结构体
     //失败返回NO_RESOURCE状态，表示资源不存在
-    if (stat(m_real_file, &m_file_stat) < 0)
+    //开启文件缓存时stat结果、打开的fd和映射都从缓存取得
+    file_cache *cache = file_cache::GetInstance();
+    if (cache->enabled())
+    {
+        if (cache->acquire(m_real_file, m_file_entry, m_file_stat) < 0)
+            return NO_RESOURCE;
+    }
+    else if (stat(m_real_file, &m_file_stat) < 0)
         return NO_RESOURCE;
     //判断文件的权限，是否可读，不可读则返回FORBIDDEN_REQUEST状态
     if (!(m_file_stat.st_mode & S_IROTH))
@@ -545,156 +869,531 @@ http_conn::HTTP_CODE http_conn::do_request()
     //判断文件类型，如果是目录，则返回BAD_REQUEST，表示请求报文有误
     if (S_ISDIR(m_file_stat.st_mode))
         return BAD_REQUEST;
-    //以只读方式获取文件描述符，通过mmap将该文件映射到内存中
+    //类型按原文件的扩展名确定，换成预压缩的文件之前查表
+    const char *type = mime::type_of(m_real_file);
+    //可压缩的类型不管发送哪个版本都带Vary，客户端接受时换成预压缩的文件
+    if (m_precompress && S_ISREG(m_file_stat.st_mode) && is_compressible(m_real_file))
+    {
+        m_vary = true;
+        if (m_accept_enc & m_precompress)
+            select_encoding();
+    }
+    //文件响应都带验证器，客户端缓存仍然有效时回复304，不再打开文件
+    m_validators = true;
+    if (m_method == GET && not_modified())
+    {
+        if (m_file_entry)
+        {
+            cache->release(m_file_entry);
+            m_file_entry = NULL;
+        }
+        return NOT_MODIFIED;
+    }
+    m_content_type = type;
+    //文件响应都声明支持Range，GET请求带Range时只发送请求的一段
+    m_accept_ranges = true;
+    if (m_headers.get(header::RANGE) && m_method == GET && select_range() < 0)
+    {
+        if (m_file_entry)
+        {
+            cache->release(m_file_entry);
+            m_file_entry = NULL;
+        }
+        return RANGE_NOT_SATISFIABLE;
+    }
+    //缓存命中，直接使用缓存的fd或映射
+    if (m_file_entry)
+    {
+        if (m_use_sendfile)
+            m_file_fd = m_file_entry->fd;
+        else
+            m_file_address = m_file_entry->addr;
+        return FILE_REQUEST;
+    }
+    //以只读方式获取文件描述符
     int fd = open(m_real_file, O_RDONLY);
+    if (fd < 0)
+        return NO_RESOURCE;
+    //sendfile方式保留fd，正文直接从页缓存发送，整个发送队列发完后再关闭
+    if (m_use_sendfile)
+    {
+        m_file_fd = fd;
+        return FILE_REQUEST;
+    }
+    //通过mmap将该文件映射到内存中
     m_file_address = (char *)mmap(0, m_file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
     //避免文件描述符的浪费和占用
     close(fd);
     //表示请求文件存在，且可以访问
     return FILE_REQUEST;
 }
+//解析HTTP-date(IMF-fixdate)，格式不对时返回-1
+static time_t parse_http_date(const char *text)
+{
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    const char *end = strptime(text, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    if (!end)
+        return -1;
+    return timegm(&tm);
+}
+
+//由inode、大小和修改时间生成强ETag，文件被替换或修改后都会变化
+//格式为"ino-size-mtime"，都是十六进制，buf至少52字节，返回长度
+static int make_etag(const struct stat &st, char *buf)
+{
+    char *p = buf;
+    *p++ = '"';
+    p += resp::xtoa((unsigned long)st.st_ino, p);
+    *p++ = '-';
+    p += resp::xtoa((unsigned long long)st.st_size, p);
+    *p++ = '-';
+    p += resp::xtoa((unsigned long)st.st_mtime, p);
+    *p++ = '"';
+    *p = '\0';
+    return p - buf;
+}
+
+//If-None-Match中是否有和etag匹配的实体标签，按弱比较忽略W/前缀
+static bool etag_listed(const char *list, const char *etag)
+{
+    size_t etag_len = strlen(etag);
+    const char *p = list;
+    while (*p)
+    {
+        p += strspn(p, " \t,");
+        if (*p == '*')
+            return true;
+        if (strncmp(p, "W/", 2) == 0)
+            p += 2;
+        if (*p != '"')
+            break;
+        const char *end = strchr(p + 1, '"');
+        if (!end)
+            break;
+        if ((size_t)(end + 1 - p) == etag_len && strncmp(p, etag, etag_len) == 0)
+            return true;
+        p = end + 1;
+    }
+    return false;
+}
+
+bool http_conn::not_modified()
+{
+    if (!S_ISREG(m_file_stat.st_mode))
+        return false;
+    //有If-None-Match时忽略If-Modified-Since
+    const char *if_none_match = m_headers.value(header::IF_NONE_MATCH);
+    const char *if_modified_since = m_headers.value(header::IF_MODIFIED_SINCE);
+    if (if_none_match)
+    {
+        char etag[64];
+        make_etag(m_file_stat, etag);
+        return etag_listed(if_none_match, etag);
+    }
+    if (if_modified_since)
+    {
+        time_t since = parse_http_date(if_modified_since);
+        return since >= 0 && m_file_stat.st_mtime <= since;
+    }
+    return false;
+}
+
+//解析bytes=的单个范围，返回1表示得到[start, start+len)，0表示忽略Range发送整个文件，-1表示无法满足。
+//多个范围的请求也按整个文件回复200
+static int parse_range(const char *text, off_t size, off_t &start, off_t &len)
+{
+    if (strncasecmp(text, "bytes=", 6) != 0)
+        return 0;
+    text += 6;
+    text += strspn(text, " \t");
+    if (strchr(text, ','))
+        return 0;
+
+    char *end;
+    if (*text == '-')
+    {
+        //bytes=-n，最后n个字节
+        off_t n = strtoll(text + 1, &end, 10);
+        if (end == text + 1 || *(end + strspn(end, " \t")) != '\0')
+            return 0;
+        if (n <= 0)
+            return -1;
+        start = n < size ? size - n : 0;
+        len = size - start;
+        return 1;
+    }
+    if (*text < '0' || *text > '9')
+        return 0;
+    off_t first = strtoll(text, &end, 10);
+    if (*end != '-')
+        return 0;
+    text = end + 1;
+    off_t last = size - 1;
+    //bytes=a-b，没有b时到文件末尾
+    if (*text >= '0' && *text <= '9')
+    {
+        last = strtoll(text, &end, 10);
+        text = end;
+        if (last < first)
+            return 0;
+    }
+    if (*(text + strspn(text, " \t")) != '\0')
+        return 0;
+    if (first >= size)
+        return -1;
+    if (last >= size)
+        last = size - 1;
+    start = first;
+    len = last - first + 1;
+    return 1;
+}
+
+int http_conn::select_range()
+{
+    //大小为0的文件没有可以取的范围，按整个文件回复
+    if (!S_ISREG(m_file_stat.st_mode) || m_file_stat.st_size == 0)
+        return 0;
+    //If-Range中的ETag或日期和文件不一致，说明客户端缓存的部分已经过期，发送整个文件；
+    //ETag按强比较，弱标签不能匹配
+    const char *if_range = m_headers.value(header::IF_RANGE);
+    if (if_range)
+    {
+        if (if_range[0] == '"')
+        {
+            char etag[64];
+            make_etag(m_file_stat, etag);
+            if (strcmp(if_range, etag) != 0)
+                return 0;
+        }
+        else if (strncmp(if_range, "W/", 2) == 0 || parse_http_date(if_range) != m_file_stat.st_mtime)
+            return 0;
+    }
+    int ret = parse_range(m_headers.value(header::RANGE), m_file_stat.st_size, m_range_start, m_range_len);
+    m_partial = ret > 0;
+    return ret;
+}
+
+//按br、gzip的顺序找客户端接受且存在的压缩文件，比原文件旧的视为过期
+void http_conn::select_encoding()
+{
+    static const struct
+    {
+        int enc;
+        const char *suffix;
+        const char *name;
+    } variants[] = {{ENC_BR, ".br", "br"}, {ENC_GZIP, ".gz", "gzip"}};
+
+    file_cache *cache = file_cache::GetInstance();
+    for (size_t i = 0; i < sizeof(variants) / sizeof(variants[0]); ++i)
+    {
+        if (!(m_accept_enc & m_precompress & variants[i].enc))
+            continue;
+        char path[FILENAME_LEN];
+        if (snprintf(path, FILENAME_LEN, "%s%s", m_real_file, variants[i].suffix) >= FILENAME_LEN)
+            continue;
+        file_entry *entry = NULL;
+        struct stat st;
+        if (cache->enabled() ? cache->acquire(path, entry, st) < 0 : stat(path, &st) < 0)
+            continue;
+        if (!S_ISREG(st.st_mode) || !(st.st_mode & S_IROTH) || st.st_mtime < m_file_stat.st_mtime)
+        {
+            if (entry)
+                cache->release(entry);
+            continue;
+        }
+        if (m_file_entry)
+            cache->release(m_file_entry);
+        m_file_entry = entry;
+        m_file_stat = st;
+        strcpy(m_real_file, path);
+        m_content_encoding = variants[i].name;
+        return;
+    }
+}
+
+//取消映射并关闭sendfile用的文件
 void http_conn::unmap()
 {
+    //已排进发送队列的文件
+    for (int i = 0; i < m_mapped_count; ++i)
+        munmap(m_mapped[i].iov_base, m_mapped[i].iov_len);
+    m_mapped_count = 0;
+    for (int i = 0; i < m_iv_count; ++i)
+    {
+        //缓存的文件只归还条目，由缓存决定何时关闭
+        if (m_iv_entry[i])
+        {
+            file_cache::GetInstance()->release(m_iv_entry[i]);
+            m_iv_entry[i] = NULL;
+        }
+        else if (m_iv_fd[i] >= 0)
+        {
+            close(m_iv_fd[i]);
+        }
+        m_iv_fd[i] = -1;
+    }
+    if (m_file_entry)
+    {
+        file_cache::GetInstance()->release(m_file_entry);
+        m_file_entry = NULL;
+        m_file_address = 0;
+        m_file_fd = -1;
+    }
     if (m_file_address)
     {
         munmap(m_file_address, m_file_stat.st_size);
         m_file_address = 0;
     }
+    if (m_file_fd >= 0)
+    {
+        close(m_file_fd);
+        m_file_fd = -1;
+    }
+}
+
+void http_conn::release()
+{
+    unmap();
+    free_read_buf();
+    if (m_body_fd >= 0)
+    {
+        close(m_body_fd);
+        m_body_fd = -1;
+    }
+}
+
+//已发送bytes字节，跳过发完的iovec，调整发送到一半的那个
+void http_conn::consume_iv(ssize_t bytes)
+{
+    bytes_have_send += bytes;
+    bytes_to_send -= bytes;
+    while (bytes > 0 && m_iv_idx < m_iv_count)
+    {
+        struct iovec *iv = &m_iv[m_iv_idx];
+        if ((size_t)bytes >= iv->iov_len)
+        {
+            bytes -= iv->iov_len;
+            ++m_iv_idx;
+        }
+        else
+        {
+            iv->iov_base = (char *)iv->iov_base + bytes;
+            iv->iov_len -= bytes;
+            bytes = 0;
+        }
+    }
 }
 
-bool http_conn::write()
+//响应队列全部发出，返回false表示需要关闭连接
+bool http_conn::finish_write()
 {
-    int temp = 0;
-    int newadd = 0;
+    unmap();
+    if (!m_keep_alive)
+        return false;
+    init_write();
+    //没有流水线的后续数据时连接进入空闲，归还读缓冲区
+    if (m_start_line >= m_read_idx)
+        free_read_buf();
+    return true;
+}
+
+bool http_conn::write(bool &pending)
+{
+    ssize_t temp = 0;
+    pending = false;
     //若要发送的数据长度为0
     //表示响应报文为空，一般不会出现这种情况
     if (bytes_to_send == 0)
     {
-        modfd(m_epollfd, m_sockfd, EPOLLIN);
         init();
+        rearm(EPOLLIN);
         return true;
     }
 
     while (1)
     {
-        //将响应报文的状态行、消息头、空行和响应正文发送给浏览器端
-        temp = writev(m_sockfd, m_iv, m_iv_count);
-        //正常发送，temp为发送的字节数
-        if (temp > 0)
+        if (m_iv_fd[m_iv_idx] >= 0)
+        {
+            //sendfile直接从页缓存发送文件，iov_base中存放的是文件偏移
+            off_t offset = (off_t)(long)m_iv[m_iv_idx].iov_base;
+            temp = sendfile(m_sockfd, m_iv_fd[m_iv_idx], &offset, m_iv[m_iv_idx].iov_len);
+        }
+        else
         {
-            //更新已发送字节
-            bytes_have_send += temp;
-            //偏移文件iovec的指针
-            newadd = bytes_have_send - m_write_idx;
+            //将队列中所有响应的状态行、消息头、空行和mmap的正文一次发送给浏览器端，
+            //遇到sendfile的文件为止，此时带上MSG_MORE，让头部和随后的正文合并成完整的报文段
+            int end = m_iv_idx;
+            while (end < m_iv_count && m_iv_fd[end] < 0)
+                ++end;
+            struct msghdr msg;
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_iov = m_iv + m_iv_idx;
+            msg.msg_iovlen = end - m_iv_idx;
+            temp = sendmsg(m_sockfd, &msg, end < m_iv_count ? MSG_MORE : 0);
         }
         if (temp < 0)
         {
-            //判断缓冲区是否满了
+            //判断缓冲区是否满了，iovec已按发送进度调整好，等待下次可写
             if (errno == EAGAIN)
             {
-                //第一个iovec头部信息的数据已发送完，发送第二个iovec数据
-                if (bytes_have_send >= m_iv[0].iov_len)
-                {
-                    //不再继续发送头部信息
-                    m_iv[0].iov_len = 0;
-                    m_iv[1].iov_base = m_file_address + newadd;
-                    m_iv[1].iov_len = bytes_to_send;
-                }
-                //继续发送第一个iovec头部信息的数据
-                else
-                {
-                    m_iv[0].iov_base = m_write_buf + bytes_to_send;
-                    m_iv[0].iov_len = m_iv[0].iov_len - bytes_have_send;
-                }
-                modfd(m_epollfd, m_sockfd, EPOLLOUT);
+                rearm(EPOLLOUT);
                 return true;
             }
             //如果发送失败，但不是缓冲区问题，取消映射
             unmap();
             return false;
         }
-
-        bytes_to_send -= temp;
+        //文件在发送过程中被截断
+        if (temp == 0)
+        {
+            unmap();
+            return false;
+        }
+        //正常发送，temp为发送的字节数，更新已发送字节并偏移iovec
+        consume_iv(temp);
 
         //判断条件，数据已全部发送完
         if (bytes_to_send <= 0)
         {
-            unmap();
-            modfd(m_epollfd, m_sockfd, EPOLLIN);
-
-            if (m_linger)
-            {
-                init();
-                return true;
-            }
-            else
-            {
+            if (!finish_write())
                 return false;
-            }
+            //缓冲区里还有流水线的后续请求时由调用者交给工作线程继续解析，不再注册读事件。
+            //注册读事件之后连接可能已经被别的工作线程处理，所以要在这之前判断
+            pending = pending_request();
+            if (!pending)
+                rearm(EPOLLIN);
+            return true;
         }
     }
 }
 
-bool http_conn::add_response(const char *format, ...)
+//io_uring后端的writev完成后调用，按已发送字节数调整iovec
+bool http_conn::write_complete(int bytes, bool &done)
 {
-    //如果写入内容超出m_write_buf大小则报错
-    if (m_write_idx >= WRITE_BUFFER_SIZE)
-        return false;
-    //定义可变参数列表
-    va_list arg_list;
-    //将变量arg_list初始化为传入参数
-    va_start(arg_list, format);
-    //将数据format从可变参数列表写入缓冲区写，返回写入数据的长度
-    int len = vsnprintf(m_write_buf + m_write_idx, WRITE_BUFFER_SIZE - 1 - m_write_idx, format, arg_list);
-    //如果写入的数据长度超过缓冲区剩余空间，则报错
-    if (len >= (WRITE_BUFFER_SIZE - 1 - m_write_idx))
-    {
-        va_end(arg_list);
-        return false;
+    consume_iv(bytes);
+    done = false;
+
+    //数据已全部发送完
+    if (bytes_to_send <= 0)
+    {
+        done = true;
+        return finish_write();
     }
-    //更新m_write_idx位置
+    return true;
+}
+
+void http_conn::rearm(int ev)
+{
+    if (m_rearm)
+        m_rearm(m_owner, m_sockfd, ev);
+    else
+        modfd(m_epollfd, m_sockfd, ev);
+}
+
+//向m_write_buf追加一段文本，写不下时报错
+bool http_conn::add_raw(const char *text, int len)
+{
+    if (len > WRITE_BUFFER_SIZE - m_write_idx)
+        return false;
+    memcpy(m_write_buf + m_write_idx, text, len);
     m_write_idx += len;
-    //清空可变参列表
-    va_end(arg_list);
-    printf("request:%s\n", m_write_buf);
     return true;
 }
-//添加状态行
-bool http_conn::add_status_line(int status, const char *title)
+//添加一个头部字段，name包括冒号
+bool http_conn::add_header(const char *name, int name_len, const char *value, int value_len)
+{
+    if (name_len + value_len + 2 > WRITE_BUFFER_SIZE - m_write_idx)
+        return false;
+    char *p = m_write_buf + m_write_idx;
+    memcpy(p, name, name_len);
+    memcpy(p + name_len, value, value_len);
+    p[name_len + value_len] = '\r';
+    p[name_len + value_len + 1] = '\n';
+    m_write_idx += name_len + value_len + 2;
+    return true;
+}
+//添加状态行和Date，所有响应都以这两行开始
+bool http_conn::add_status_line(const status_text &status)
 {
-    return add_response("%s %d %s\r\n", "HTTP/1.1", status, title);
+    return add_raw(status.line, status.line_len) && add_raw(resp::date_line(), resp::DATE_LINE_LEN);
 }
-//添加消息报头，具体的添加文本长度、连接状态和空行
-bool http_conn::add_headers(int content_len)
+//添加消息报头，具体的添加文本长度、连接状态和空行；任何一行写不下都返回false
+bool http_conn::add_headers(off_t content_len)
 {
-    add_content_length(content_len);
-    add_linger();
-    add_blank_line();
+    return add_content_length(content_len) && add_linger() && add_file_headers() && add_blank_line();
+}
+//文件响应的附加头部，只在对应的标志置位时添加
+bool http_conn::add_file_headers()
+{
+    if (m_content_type && !add_content_type())
+        return false;
+    if (m_content_encoding && !add_header(LIT("Content-Encoding:"), m_content_encoding, strlen(m_content_encoding)))
+        return false;
+    if (m_vary && !add_raw(LIT("Vary:Accept-Encoding\r\n")))
+        return false;
+    if (m_accept_ranges && !add_raw(LIT("Accept-Ranges:bytes\r\n")))
+        return false;
+    if (m_validators)
+    {
+        char buf[64];
+        if (!add_header(LIT("ETag:"), buf, make_etag(m_file_stat, buf)))
+            return false;
+        if (!add_header(LIT("Last-Modified:"), buf, resp::http_date(m_file_stat.st_mtime, buf)))
+            return false;
+    }
+    return true;
 }
 //添加Content-Length，表示响应报文的长度
-bool http_conn::add_content_length(int content_len)
+bool http_conn::add_content_length(off_t content_len)
 {
-    return add_response("Content-Length:%d\r\n", content_len);
+    char buf[20];
+    return add_header(LIT("Content-Length:"), buf, resp::utoa(content_len, buf));
 }
-//添加文本类型，这里是html
+//添加Content-Range，start为负时表示无法满足，只给出文件大小
+bool http_conn::add_content_range(off_t start, off_t len, off_t size)
+{
+    char buf[64];
+    char *p = buf;
+    if (start < 0)
+        *p++ = '*';
+    else
+    {
+        p += resp::utoa(start, p);
+        *p++ = '-';
+        p += resp::utoa(start + len - 1, p);
+    }
+    *p++ = '/';
+    p += resp::utoa(size, p);
+    return add_header(LIT("Content-Range:bytes "), buf, p - buf);
+}
+//添加文件的类型，在do_request中按扩展名确定
 bool http_conn::add_content_type()
 {
-    return add_response("Content-Type:%s\r\n", "text/html");
+    return add_header(LIT("Content-Type:"), m_content_type, strlen(m_content_type));
 }
 //添加连接状态，通知浏览器端是保持连接还是关闭
 bool http_conn::add_linger()
 {
-    return add_response("Connection:%s\r\n", (m_linger == true) ? "keep-alive" : "close");
+    if (m_linger)
+        return add_raw(LIT("Connection:keep-alive\r\n"));
+    return add_raw(LIT("Connection:close\r\n"));
 }
 //添加空行
 bool http_conn::add_blank_line()
 {
-    return add_response("%s", "\r\n");
+    return add_raw(LIT("\r\n"));
 }
-//添加文本content
-bool http_conn::add_content(const char *content)
+//添加错误响应，正文是预先生成的错误页面
+bool http_conn::add_error(const status_text &status)
 {
-    return add_response("%s", content);
+    return add_status_line(status) && add_error_headers(status.form_len) && add_raw(status.form, status.form_len);
+}
+//请求的文件已经确定之后才可能出错(如416)，这时m_content_type等还指向文件，不能用add_file_headers
+bool http_conn::add_error_headers(off_t content_len)
+{
+    return add_content_length(content_len) && add_linger() && add_raw(LIT("Content-Type:text/html\r\n")) &&
+           add_blank_line();
 }
 bool http_conn::process_write(HTTP_CODE ret)
 {
@@ -703,85 +1402,188 @@ bool http_conn::process_write(HTTP_CODE ret)
     //内部错误，500
     case INTERNAL_ERROR:
     {
-        //状态行
-        add_status_line(500, error_500_title);
-        //消息报头
-        add_headers(strlen(error_500_form));
-        if (!add_content(error_500_form))
+        if (!add_error(error_500))
             return false;
         break;
     }
-    //报文语法有误，404
+    //报文语法有误，400
     case BAD_REQUEST:
     {
-        add_status_line(404, error_404_title);
-        add_headers(strlen(error_404_form));
-        if (!add_content(error_404_form))
+        if (!add_error(error_400))
+            return false;
+        break;
+    }
+    //请求的文件不存在，404
+    case NO_RESOURCE:
+    {
+        if (!add_error(error_404))
             return false;
         break;
     }
     //资源没有访问权限，403
     case FORBIDDEN_REQUEST:
     {
-        add_status_line(403, error_403_title);
-        add_headers(strlen(error_403_form));
-        if (!add_content(error_403_form))
+        if (!add_error(error_403))
+            return false;
+        break;
+    }
+    //客户端缓存仍然有效，304没有消息体，也不带Content-Length
+    case NOT_MODIFIED:
+    {
+        if (!add_status_line(ok_304) || !add_linger() || !add_file_headers() || !add_blank_line())
+            return false;
+        break;
+    }
+    //Range超出文件范围，416，Content-Range给出文件大小
+    case RANGE_NOT_SATISFIABLE:
+    {
+        if (!add_status_line(error_416) || !add_content_range(-1, 0, m_file_stat.st_size) ||
+            !add_error_headers(error_416.form_len) || !add_raw(error_416.form, error_416.form_len))
             return false;
         break;
     }
     //文件存在，200
     case FILE_REQUEST:
     {
-        add_status_line(200, ok_200_title);
+        //只请求一段时发送206，正文是文件中的一段，同样走mmap或sendfile
+        if (m_partial)
+        {
+            if (!add_status_line(ok_206) || !add_content_range(m_range_start, m_range_len, m_file_stat.st_size) ||
+                !add_headers(m_range_len))
+                return false;
+            queue_response(m_file_address, m_file_fd, m_range_start, m_range_len);
+            return true;
+        }
+        if (!add_status_line(ok_200))
+            return false;
+        //小文件命中缓存时，状态行和Date之后的头部连同正文一起发送，不再生成
+        const char *resp;
+        int resp_len;
+        if (m_file_entry && file_cache::GetInstance()->get_response(m_file_entry, m_content_encoding != NULL, m_linger, resp, resp_len))
+        {
+            queue_response((char *)resp, -1, 0, resp_len);
+            return true;
+        }
         //如果请求的资源存在
         if (m_file_stat.st_size != 0)
         {
-            add_headers(m_file_stat.st_size);
-            //第一个iovec指针指向响应报文缓冲区，长度指向m_write_idx
-            m_iv[0].iov_base = m_write_buf;
-            m_iv[0].iov_len = m_write_idx;
-            //第二个iovec指针指向mmap返回的文件指针，长度指向文件大小
-            m_iv[1].iov_base = m_file_address;
-            m_iv[1].iov_len = m_file_stat.st_size;
-            m_iv_count = 2;
-            //发送的全部数据为响应报文头部信息和文件大小
-            bytes_to_send = m_write_idx + m_file_stat.st_size;
+            int fields = m_write_idx;
+            if (!add_headers(m_file_stat.st_size))
+                return false;
+            if (m_file_entry)
+                file_cache::GetInstance()->put_response(m_file_entry, m_content_encoding != NULL, m_linger, m_write_buf + fields,
+                                                        m_write_idx - fields);
+            //头部后面跟一个iovec指向mmap返回的文件指针或sendfile的文件，长度为文件大小
+            queue_response(m_file_address, m_file_fd, 0, m_file_stat.st_size);
             return true;
         }
         else
         {
             //如果请求的资源大小为0，则返回空白html文件
-            const char *ok_string = "<html><body></body></html>";
-            add_headers(strlen(ok_string));
-            if (!add_content(ok_string))
+            static const char ok_string[] = "<html><body></body></html>";
+            if (!add_headers(sizeof(ok_string) - 1) || !add_raw(LIT(ok_string)))
                 return false;
         }
+        break;
     }
     default:
         return false;
     }
-    //除FILE_REQUEST状态外，其余状态只申请一个iovec，指向响应报文缓冲区
-    m_iv[0].iov_base = m_write_buf;
-    m_iv[0].iov_len = m_write_idx;
-    m_iv_count = 1;
-    bytes_to_send = m_write_idx;
+    //除FILE_REQUEST状态外，其余状态的响应只在响应报文缓冲区中
+    queue_response(NULL, -1, 0, 0);
     return true;
 }
+
+//把刚生成的响应排进发送队列，头部在m_write_buf中m_resp_start之后
+//正文是mmap的文件file，或者用sendfile发送的文件fd，从文件的offset处开始
+void http_conn::queue_response(char *file, int fd, off_t offset, off_t file_len)
+{
+    char *head = m_write_buf + m_resp_start;
+    int len = m_write_idx - m_resp_start;
+    struct iovec *last = m_iv_count ? &m_iv[m_iv_count - 1] : NULL;
+    //上一个响应没有文件时，两个响应在m_write_buf中是连续的，合并成一个iovec
+    if (last && m_iv_fd[m_iv_count - 1] < 0 && !m_iv_entry[m_iv_count - 1] &&
+        (char *)last->iov_base + last->iov_len == head)
+    {
+        last->iov_len += len;
+    }
+    else
+    {
+        m_iv[m_iv_count].iov_base = head;
+        m_iv[m_iv_count].iov_len = len;
+        m_iv_fd[m_iv_count] = -1;
+        m_iv_entry[m_iv_count] = NULL;
+        ++m_iv_count;
+    }
+    bytes_to_send += len;
+    if (file || fd >= 0)
+    {
+        //sendfile的文件项在iov_base中存放文件偏移，consume_iv移动iov_base就是移动偏移
+        m_iv[m_iv_count].iov_base = fd >= 0 ? (void *)(long)offset : file + offset;
+        m_iv[m_iv_count].iov_len = file_len;
+        m_iv_fd[m_iv_count] = fd;
+        m_iv_entry[m_iv_count] = m_file_entry;
+        ++m_iv_count;
+        //文件在整个队列发完后才能取消映射或关闭，缓存的文件在那时归还条目
+        if (fd < 0 && !m_file_entry)
+        {
+            m_mapped[m_mapped_count].iov_base = file;
+            m_mapped[m_mapped_count].iov_len = m_file_stat.st_size;
+            ++m_mapped_count;
+        }
+        m_file_address = 0;
+        m_file_fd = -1;
+        m_file_entry = NULL;
+        bytes_to_send += file_len;
+    }
+    ++m_resp_count;
+    m_resp_start = m_write_idx;
+    __sync_fetch_and_add(&m_request_count, 1);
+}
+
 void http_conn::process()
 {
-    HTTP_CODE read_ret = process_read();
-    //NO_REQUEST，表示请求不完整，需要继续接收请求数据
-    if (read_ret == NO_REQUEST)
+    //HTTP/1.1流水线：读缓冲区中可能有多个完整的请求，逐个解析并把响应依次排进发送队列，
+    //最后用一次writev按顺序发出。队列满或写缓冲区放不下下一个响应时先发送，
+    //发完后由finish_write保留剩下的数据，再回到这里继续解析
+    while (m_resp_count < MAX_PIPELINE)
     {
-        modfd(m_epollfd, m_sockfd, EPOLLIN);
-        return;
+        if (m_resp_count > 0 && WRITE_BUFFER_SIZE - m_write_idx < RESPONSE_RESERVE)
+            break;
+        HTTP_CODE read_ret = process_read();
+        //NO_REQUEST，表示请求不完整，需要继续接收请求数据
+        if (read_ret == NO_REQUEST)
+            break;
+        //调用process_write生成报文响应，失败时关闭连接，已排队的响应先发出去
+        if (!process_write(read_ret))
+        {
+            //丢弃写了一半的响应头部，已排队的响应不受影响
+            m_write_idx = m_resp_start;
+            if (m_resp_count > 0)
+            {
+                m_keep_alive = false;
+                break;
+            }
+            unmap();
+            close_conn();
+            return;
+        }
+        m_keep_alive = m_linger;
+        //报文有语法错误时找不到下一个请求的起点，丢弃缓冲区中剩下的数据
+        //消息体由parse_content解析，m_checked_idx已经在下一个请求的起点
+        if (read_ret == BAD_REQUEST)
+            m_checked_idx = m_read_idx;
+        m_start_line = m_checked_idx;
+        init_request();
+        //不保持连接时后面的请求不再处理
+        if (!m_keep_alive)
+            break;
     }
-    //调用process_write完成报文响应
-    bool write_ret = process_write(read_ret);
-    if (!write_ret)
+    if (m_resp_count == 0)
     {
-        close_conn();
+        rearm(EPOLLIN);
+        return;
     }
     //注册并监听写事件
-    modfd(m_epollfd, m_sockfd, EPOLLOUT);
+    rearm(EPOLLOUT);
 }
@@ -21,15 +21,34 @@
 #include <sys/uio.h>
 #include "../lock/locker.h"
 #include "../CGImysql/sql_connection_pool.h"
+#include "../slab/buf_pool.h"
+#include "../cache/file_cache.h"
+#include "../cache/precompress.h"
+#include "mime.h"
+#include "scanner.h"
+#include "header_table.h"
+#include "resp_format.h"
+//预先生成的状态行和错误页面，定义在http_conn.cpp中
+struct status_text;
 class http_conn
 {
 public:
     //设置读取文件的名称m_real_file大小
     static const int FILENAME_LEN = 200;
-    //设置读缓冲区m_read_buf大小
+    //读缓冲区第一个段的大小，也是io_uring每个接收缓冲区的大小
     static const int READ_BUFFER_SIZE = 2048;
     //设置写缓冲区m_write_buf大小
-    static const int WRITE_BUFFER_SIZE = 1024;
+    static const int WRITE_BUFFER_SIZE = 2048;
+    //一次writev最多发送的流水线响应数
+    static const int MAX_PIPELINE = 16;
+    //写缓冲区剩余空间小于该值时不再解析下一个请求，先发送已排队的响应
+    static const int RESPONSE_RESERVE = 512;
+    //消息体留在读缓冲区中的上限，超过时写入临时文件，实际还不超过读缓冲区上限的一半
+    static const int BODY_MEM_MAX = 8192;
+    //消息体总长度上限，包括写入临时文件的部分
+    static const int BODY_MAX = 64 * 1024 * 1024;
+    //chunked编码中块大小一行的长度上限
+    static const int CHUNK_LINE_MAX = 256;
     //报文的请求方法，本项目只用到GET和POST
     enum METHOD{GET = 0,POST,HEAD,PUT,DELETE,TRACE,OPTIONS,CONNECT,PATH};
     //主状态机的状态
@@ -38,6 +57,13 @@ public:
         CHECK_STATE_HEADER,             //解析请求头
         CHECK_STATE_CONTENT             //解析消息体，仅用于解析POST请求
     };
+    //连接所处的阶段，事件循环按阶段选择超时时间
+    enum PHASE{
+        PHASE_KEEPALIVE = 0,    //没有未完成的请求，等待下一个请求
+        PHASE_HEADER,           //正在接收请求行和请求头
+        PHASE_BODY,             //正在接收消息体
+        PHASE_WRITE             //响应还没有发完
+    };
     //报文解析的结果
     enum HTTP_CODE{
         NO_REQUEST,         //请求不完整，需要继续读取请求报文数据
@@ -46,9 +72,19 @@ public:
         NO_RESOURCE,
         FORBIDDEN_REQUEST,
         FILE_REQUEST,
+        RANGE_NOT_SATISFIABLE,  //Range超出文件范围，416
+        NOT_MODIFIED,           //条件请求的验证器匹配，304
         INTERNAL_ERROR,     //服务器内部错误，该结果在主状态机逻辑switch的default下，一般不会触发
         CLOSED_CONNECTION
     };
+    //消息体的解析状态
+    enum BODY_STATE{
+        BODY_DATA = 0,      //接收Content-Length或当前块的数据
+        BODY_CHUNK_SIZE,    //等待块大小一行
+        BODY_CHUNK_CRLF,    //块数据后的\r\n
+        BODY_TRAILER,       //最后一个块之后的trailer，以空行结束
+        BODY_DONE
+    };
     //从状态机的状态
     enum LINE_STATUS{
         LINE_OK = 0,    //完整读取一行
@@ -57,28 +93,73 @@ public:
     };
 
 public:
-    http_conn() {}
-    ~http_conn() {}
+    http_conn() : m_read_head(NULL), m_read_buf(NULL), m_read_size(0), m_read_total(0), m_body_fd(-1) {}
+    ~http_conn()
+    {
+        free_read_buf();
+    }
 
 public:
     //初始化套接字地址，函数内部会调用私有方法init
-    void init(int sockfd, const sockaddr_in &addr);
+    //epollfd为连接所属事件循环的内核事件表
+    //rearm回调把事件交还给所属事件循环owner，io_uring后端没有epollfd(传-1)
+    void init(int sockfd, const sockaddr_in &addr, int epollfd,
+              void *owner = NULL, void (*rearm)(void *owner, int sockfd, int ev) = NULL);
     //关闭http连接
     void close_conn(bool real_close = true);
     void process();
     //读取浏览器端发来的全部数据
     bool read_once();
-    //响应报文写入函数
-    bool write();
+    //响应报文写入函数，pending返回读缓冲区中是否还有流水线的后续请求，此时没有重新注册读事件
+    bool write(bool &pending);
+    //io_uring后端：把内核已收到的数据追加到读缓冲区
+    bool read_append(const char *data, int len);
+    //io_uring后端：取出待发送的iovec
+    struct iovec *get_iv(int &count)
+    {
+        count = m_iv_count - m_iv_idx;
+        return m_iv + m_iv_idx;
+    }
+    //io_uring后端：writev完成bytes字节后更新发送状态，done表示响应已全部发出
+    //返回false表示需要关闭连接
+    bool write_complete(int bytes, bool &done);
     sockaddr_in *get_address()
     {
         return &m_address;
     }
+    int get_sockfd()
+    {
+        return m_sockfd;
+    }
     //同步线程初始化数据库读取表
-    void initmysql_result(connection_pool *connPool);
+    static void initmysql_result(connection_pool *connPool);
+    //启用预压缩的编码(ENC_*)，并为网站根目录下的文件生成压缩文件
+    static void init_precompress(int encodings);
+    //连接关闭时调用，取消文件映射、关闭sendfile的文件并归还读缓冲区
+    void release();
+    //响应已全部发出，读缓冲区中还有流水线的后续请求未解析
+    bool pending_request()
+    {
+        return m_resp_count == 0 && m_start_line < m_read_idx;
+    }
+    //由事件循环在连接不被工作线程处理时调用
+    PHASE phase() const
+    {
+        if (bytes_to_send > 0)
+            return PHASE_WRITE;
+        if (m_check_state == CHECK_STATE_CONTENT)
+            return PHASE_BODY;
+        if (m_check_state == CHECK_STATE_HEADER || m_start_line < m_read_idx)
+            return PHASE_HEADER;
+        return PHASE_KEEPALIVE;
+    }
 
 private:
     void init();
+    void init_request();
+    void init_write();
+    //把读缓冲区的段全部还给缓冲池，连接空闲或关闭时调用
+    void free_read_buf();
     //从m_read_buf读取，并处理请求报文
     HTTP_CODE process_read();
     //向m_write_buf写入响应报文数据
@@ -88,9 +169,20 @@ private:
     //主状态机解析报文中的请求头数据
     HTTP_CODE parse_headers(char *text);
     //主状态机解析报文中的请求内容
-    HTTP_CODE parse_content(char *text);
+    //消息体边收边解码，m_start_line之后只保留解码后的数据，超过内存上限的部分写入临时文件
+    HTTP_CODE parse_content();
+    //把解码得到的n字节消息体追加到读缓冲区或临时文件
+    bool append_body(const char *data, int n);
+    //消息体留在读缓冲区中的上限
+    int body_mem_max();
     //生成响应报文
     HTTP_CODE do_request();
+    //客户端接受时把m_real_file换成预压缩的文件
+    void select_encoding();
+    //按Range和If-Range决定发送整个文件还是其中一段，返回-1表示范围无法满足
+    int select_range();
+    //If-None-Match或If-Modified-Since表明客户端的缓存仍然有效
+    bool not_modified();
 
     //get_line用于将指针向后偏移，指向未处理的字符
     //m_start_line是行在buffer中的起始位置，已经解析的字符，将该位置后面的数据赋给text
@@ -99,40 +191,78 @@ private:
 
     //从状态机读取一行，分析是请求报文的哪一部分
     LINE_STATUS parse_line();
+    //当前段写满时换一个更大的段，超出m_read_buf_max时返回false
+    bool grow_read_buf();
 
     void unmap();
+    //把刚生成的响应排进发送队列
+    void queue_response(char *file, int fd, off_t offset, off_t file_len);
+    //按已发送字节数调整iovec
+    void consume_iv(ssize_t bytes);
+    //响应队列全部发出后调用，返回false表示需要关闭连接
+    bool finish_write();
+    //重新注册事件，有rearm回调时交给所属事件循环处理，否则直接modfd
+    void rearm(int ev);
 
-    //根据响应报文格式，生成对应8个部分，以下函数均由do_request调用
-    bool add_response(const char *format, ...);
-    bool add_content(const char *content);
-    bool add_status_line(int status, const char *title);
-    bool add_headers(int content_length);
+    //根据响应报文格式，生成对应8个部分，以下函数均由process_write调用
+    //按字段类型直接复制和格式化，不经过vsnprintf
+    bool add_raw(const char *text, int len);
+    bool add_header(const char *name, int name_len, const char *value, int value_len);
+    bool add_status_line(const status_text &status);
+    bool add_headers(off_t content_length);
     bool add_content_type();
-    bool add_content_length(int content_length);
+    bool add_content_length(off_t content_length);
+    bool add_content_range(off_t start, off_t len, off_t size);
     bool add_linger();
+    bool add_error(const status_text &status);
+    //错误响应的头部，正文是错误页面，不带请求文件的类型和校验信息
+    bool add_error_headers(off_t content_length);
+    //文件响应的Content-Type、Content-Encoding、Vary、Accept-Ranges、ETag和Last-Modified
+    bool add_file_headers();
     bool add_blank_line();
 
 public:
-    static int m_epollfd;
     static int m_user_count;
+    static unsigned long m_request_count;   //已生成响应的请求总数
+    static int m_read_buf_max;  //每个连接读缓冲区的总大小上限
+    static bool m_use_sendfile; //静态文件用sendfile发送，否则mmap后writev
+    static int m_precompress;   //启用的预压缩编码，0为不使用
     MYSQL *mysql;
+    int m_state;        //Reactor模式下工作线程要处理的事件，读为0, 写为1
 
 private:
+    int m_epollfd;      //所属事件循环的epollfd
+    void *m_owner;      //io_uring后端所属的事件循环
+    void (*m_rearm)(void *owner, int sockfd, int ev);   //ev为0表示关闭连接
     int m_sockfd;
     sockaddr_in m_address;
-    //存储读取的请求报文数据
-    char m_read_buf[READ_BUFFER_SIZE];
+    //读缓冲区的段链，新段插在链头；已解析的请求行和请求头可能留在后面的旧段里，请求结束前都不释放
+    buf_seg *m_read_head;
+    //存储读取的请求报文数据，即链头段的数据区，解析只在这个段内进行
+    char *m_read_buf;
+    //m_read_buf的大小，末尾留一个字节放\0
+    int m_read_size;
+    //链上所有段的总大小
+    int m_read_total;
     //缓冲区中m_read_buf中数据的最后一个字节的下一个位置
     int m_read_idx;
     //m_read_buf读取的位置m_checked_idx
     int m_checked_idx;
     //m_read_buf中已经解析的字符个数
     int m_start_line;
+    //parse_line找到的行结尾(\r改成的\0)在m_read_buf中的位置
+    int m_line_end;
 
     //存储发出的响应报文数据
     char m_write_buf[WRITE_BUFFER_SIZE];
     //指示buffer中的长度
     int m_write_idx;
+    //正在生成的响应在m_write_buf中的起始位置
+    int m_resp_start;
+    //发送队列中的响应数
+    int m_resp_count;
+    //队列中最后一个响应是否保持连接
+    bool m_keep_alive;
 
     //主状态机的状态
     CHECK_STATE m_check_state;
@@ -145,18 +275,42 @@ private:
     char *m_url;
     char *m_version;
     char *m_host;
-    int m_content_length;
+    long long m_content_length;  //没有Content-Length时为-1
     bool m_linger;
+    header_table m_headers;             //所有请求头的切片，已知的请求头可按编号取得
+    int m_accept_enc;                   //Accept-Encoding中客户端接受的编码
+    const char *m_content_encoding;     //发送预压缩文件时的Content-Encoding
+    bool m_vary;                        //可压缩的类型要带Vary头
+    const char *m_content_type;         //按原文件扩展名确定的Content-Type
+    bool m_accept_ranges;               //文件响应带Accept-Ranges头
+    bool m_validators;                  //文件响应带ETag和Last-Modified，由m_file_stat生成
+    bool m_partial;                     //只发送文件的[m_range_start, m_range_start+m_range_len)，206
+    off_t m_range_start;
+    off_t m_range_len;
 
     
     char *m_file_address;       //读取服务器上的文件地址
+    int m_file_fd;              //sendfile方式下打开的文件
+    file_entry *m_file_entry;   //文件来自缓存时持有的条目，发送完后归还
     struct stat m_file_stat;
-    struct iovec m_iv[2];       //io向量机制iovec
+    struct iovec m_iv[2 * MAX_PIPELINE];    //io向量机制iovec，每个响应最多占两个
+    int m_iv_fd[2 * MAX_PIPELINE];          //对应的iovec是sendfile的文件时为文件fd，否则为-1
+    file_entry *m_iv_entry[2 * MAX_PIPELINE];   //对应的iovec是缓存的文件时为缓存条目，否则为NULL
     int m_iv_count;
+    int m_iv_idx;               //第一个还没发完的iovec
+    struct iovec m_mapped[MAX_PIPELINE];    //发送队列中mmap的文件
+    int m_mapped_count;
     int cgi;                    //是否启用的POST
     char *m_string;             //存储请求头数据
-    int bytes_to_send;          //剩余发送字节数
-    int bytes_have_send;        //已发送字节数
+    bool m_chunked;             //Transfer-Encoding: chunked
+    BODY_STATE m_body_state;
+    long m_body_remaining;      //Content-Length或当前块还没收到的字节数
+    int m_body_len;             //读缓冲区中m_start_line之后解码好的消息体长度
+    long m_body_total;          //消息体总长度，包括写入临时文件的部分
+    int m_body_fd;              //消息体超过内存上限时写入的临时文件，没有时为-1
+    bool m_read_full;           //读缓冲区已到上限，先交给process解析腾出空间
+    off_t bytes_to_send;        //剩余发送字节数，文件可能超过2GB
+    off_t bytes_have_send;      //已发送字节数
 };
 
 #endif
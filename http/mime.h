@@ -0,0 +1,74 @@
+﻿#ifndef MIME_H
+#define MIME_H
+
+#include <string.h>
+#include "perfect_hash.h"
+
+// 扩展名到Content-Type的映射，用编译期构造的完美哈希查找
+// 新增类型后找不到种子会在编译期报错，此时加大SLOTS即可。
+namespace mime
+{
+struct entry
+{
+    const char *key;    //扩展名，不含点
+    const char *type;
+};
+
+constexpr entry types[] = {
+    {"html", "text/html; charset=utf-8"},
+    {"htm", "text/html; charset=utf-8"},
+    {"css", "text/css; charset=utf-8"},
+    {"js", "application/javascript; charset=utf-8"},
+    {"mjs", "application/javascript; charset=utf-8"},
+    {"json", "application/json"},
+    {"txt", "text/plain; charset=utf-8"},
+    {"xml", "application/xml"},
+    {"svg", "image/svg+xml"},
+    {"ico", "image/x-icon"},
+    {"png", "image/png"},
+    {"jpg", "image/jpeg"},
+    {"jpeg", "image/jpeg"},
+    {"gif", "image/gif"},
+    {"webp", "image/webp"},
+    {"avif", "image/avif"},
+    {"bmp", "image/bmp"},
+    {"mp4", "video/mp4"},
+    {"webm", "video/webm"},
+    {"ogv", "video/ogg"},
+    {"mp3", "audio/mpeg"},
+    {"ogg", "audio/ogg"},
+    {"wav", "audio/wav"},
+    {"pdf", "application/pdf"},
+    {"woff", "font/woff"},
+    {"woff2", "font/woff2"},
+    {"ttf", "font/ttf"},
+    {"wasm", "application/wasm"},
+    {"zip", "application/zip"},
+};
+constexpr int SLOTS = 64;
+constexpr int MAX_EXT_LEN = 8;          //超过这个长度的扩展名不可能在表中
+constexpr const char *DEFAULT_TYPE = "application/octet-stream";
+
+constexpr phash::table<SLOTS> slots = phash::build<SLOTS>(types);
+static_assert(slots.seed != ~0u, "no perfect hash seed for the MIME table, enlarge SLOTS");
+
+//按扩展名查找，ext不含点，不区分大小写
+inline const char *lookup(const char *ext, size_t len)
+{
+    if (len == 0 || len > MAX_EXT_LEN)
+        return DEFAULT_TYPE;
+    int i = phash::find(slots, types, ext, len);
+    return i < 0 ? DEFAULT_TYPE : types[i].type;
+}
+
+//按文件路径的扩展名查找
+inline const char *type_of(const char *path)
+{
+    const char *dot = strrchr(path, '.');
+    if (!dot || strchr(dot, '/'))
+        return DEFAULT_TYPE;
+    return lookup(dot + 1, strlen(dot + 1));
+}
+}
+
+#endif
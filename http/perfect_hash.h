@@ -0,0 +1,92 @@
+﻿#ifndef PERFECT_HASH_H
+#define PERFECT_HASH_H
+
+#include <stddef.h>
+#include <strings.h>
+
+// 编译期构造的不区分大小写的完美哈希
+// 键表是constexpr数组，元素有const char *key成员。build在编译期找一个让所有键落在不同槽位的种子，
+// 找不到时seed为~0u，使用者用static_assert检查，加大槽位数即可。
+// 查找只算一次哈希、取一个槽位、比较一次键，没有分支链和内存分配。
+namespace phash
+{
+constexpr char lower(char c)
+{
+    return (c >= 'A' && c <= 'Z') ? c - 'A' + 'a' : c;
+}
+
+//FNV-1a，按小写计算，seed参与初始值
+constexpr unsigned int hash(const char *s, size_t len, unsigned int seed)
+{
+    unsigned int h = 2166136261u ^ seed;
+    for (size_t i = 0; i < len; ++i)
+    {
+        h ^= (unsigned char)lower(s[i]);
+        h *= 16777619u;
+    }
+    return h ^ (h >> 15);
+}
+
+constexpr size_t length(const char *s)
+{
+    size_t n = 0;
+    while (s[n])
+        ++n;
+    return n;
+}
+
+//槽位到键表下标，空槽为-1；SLOTS为2的幂
+template <int SLOTS>
+struct table
+{
+    unsigned int seed;
+    signed char index[SLOTS];
+};
+
+template <int SLOTS, typename T, int N>
+constexpr bool seed_ok(const T (&keys)[N], unsigned int seed)
+{
+    bool used[SLOTS] = {};
+    for (int i = 0; i < N; ++i)
+    {
+        unsigned int slot = hash(keys[i].key, length(keys[i].key), seed) & (SLOTS - 1);
+        if (used[slot])
+            return false;
+        used[slot] = true;
+    }
+    return true;
+}
+
+template <int SLOTS, typename T, int N>
+constexpr table<SLOTS> build(const T (&keys)[N])
+{
+    static_assert((SLOTS & (SLOTS - 1)) == 0 && N < SLOTS && N < 128, "bad perfect hash size");
+    table<SLOTS> t = {};
+    t.seed = ~0u;
+    for (unsigned int seed = 0; seed < 100000; ++seed)
+    {
+        if (seed_ok<SLOTS>(keys, seed))
+        {
+            t.seed = seed;
+            break;
+        }
+    }
+    for (int i = 0; i < SLOTS; ++i)
+        t.index[i] = -1;
+    for (int i = 0; t.seed != ~0u && i < N; ++i)
+        t.index[hash(keys[i].key, length(keys[i].key), t.seed) & (SLOTS - 1)] = i;
+    return t;
+}
+
+//返回key在键表中的下标，不在表中时返回-1
+template <int SLOTS, typename T, int N>
+inline int find(const table<SLOTS> &t, const T (&keys)[N], const char *key, size_t len)
+{
+    int i = t.index[hash(key, len, t.seed) & (SLOTS - 1)];
+    if (i < 0 || strncasecmp(keys[i].key, key, len) != 0 || keys[i].key[len] != '\0')
+        return -1;
+    return i;
+}
+}
+
+#endif
@@ -0,0 +1,140 @@
+﻿#ifndef RESP_FORMAT_H
+#define RESP_FORMAT_H
+
+#include <string.h>
+#include <time.h>
+
+// 生成响应头用到的格式化函数，代替snprintf/strftime
+// 都不写结尾的\0，返回写入的长度
+namespace resp
+{
+//"Date:" + IMF-fixdate + "\r\n"
+static const int DATE_LINE_LEN = 36;
+//IMF-fixdate固定29个字符，例如Sun, 06 Nov 1994 08:49:37 GMT
+static const int HTTP_DATE_LEN = 29;
+
+static const char digit_pairs[201] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+//十进制，buf至少20字节；每次处理两位，从后向前写入临时数组
+inline int utoa(unsigned long long v, char *buf)
+{
+    char tmp[20];
+    char *p = tmp + sizeof(tmp);
+    while (v >= 100)
+    {
+        unsigned idx = (unsigned)(v % 100) * 2;
+        v /= 100;
+        *--p = digit_pairs[idx + 1];
+        *--p = digit_pairs[idx];
+    }
+    if (v >= 10)
+    {
+        *--p = digit_pairs[v * 2 + 1];
+        *--p = digit_pairs[v * 2];
+    }
+    else
+        *--p = (char)('0' + v);
+    int len = tmp + sizeof(tmp) - p;
+    memcpy(buf, p, len);
+    return len;
+}
+
+//小写十六进制，buf至少16字节
+inline int xtoa(unsigned long long v, char *buf)
+{
+    static const char hex[] = "0123456789abcdef";
+    char tmp[16];
+    char *p = tmp + sizeof(tmp);
+    do
+    {
+        *--p = hex[v & 0xf];
+        v >>= 4;
+    } while (v);
+    int len = tmp + sizeof(tmp) - p;
+    memcpy(buf, p, len);
+    return len;
+}
+
+inline void put2(char *p, unsigned v)
+{
+    p[0] = digit_pairs[v * 2];
+    p[1] = digit_pairs[v * 2 + 1];
+}
+
+//HTTP-date，写入HTTP_DATE_LEN字节
+//由1970年以来的天数直接换算年月日，不调用gmtime_r，避免每次都查时区
+inline int http_date(time_t t, char *buf)
+{
+    static const char wdays[] = "ThuFriSatSunMonTueWed";    //1970-01-01是星期四
+    static const char months[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+    long days = t / 86400;
+    long secs = t % 86400;
+    if (secs < 0)
+    {
+        secs += 86400;
+        --days;
+    }
+    long wday = days % 7;
+    if (wday < 0)
+        wday += 7;
+    //按3月1日开始的纪年换算，闰日落在年末，400年为一个周期
+    long z = days + 719468;
+    long era = (z >= 0 ? z : z - 146096) / 146097;
+    long doe = z - era * 146097;
+    long yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    long doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    long mp = (5 * doy + 2) / 153;
+    unsigned day = doy - (153 * mp + 2) / 5 + 1;
+    unsigned month = mp < 10 ? mp + 3 : mp - 9;
+    unsigned year = yoe + era * 400 + (month <= 2);
+
+    memcpy(buf, wdays + wday * 3, 3);
+    buf[3] = ',';
+    buf[4] = ' ';
+    put2(buf + 5, day);
+    buf[7] = ' ';
+    memcpy(buf + 8, months + (month - 1) * 3, 3);
+    buf[11] = ' ';
+    put2(buf + 12, year / 100 % 100);
+    put2(buf + 14, year % 100);
+    buf[16] = ' ';
+    put2(buf + 17, secs / 3600);
+    buf[19] = ':';
+    put2(buf + 20, secs / 60 % 60);
+    buf[22] = ':';
+    put2(buf + 23, secs % 60);
+    memcpy(buf + 25, " GMT", 4);
+    return HTTP_DATE_LEN;
+}
+
+//当前时间的Date头部行，长度为DATE_LINE_LEN
+//每个线程缓存一份，秒数变化时才重新生成；CLOCK_REALTIME_COARSE走vDSO，不进内核
+inline const char *date_line()
+{
+    static thread_local time_t last = -1;
+    static thread_local char line[DATE_LINE_LEN];
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+    if (ts.tv_sec != last)
+    {
+        memcpy(line, "Date:", 5);
+        http_date(ts.tv_sec, line + 5);
+        line[DATE_LINE_LEN - 2] = '\r';
+        line[DATE_LINE_LEN - 1] = '\n';
+        last = ts.tv_sec;
+    }
+    return line;
+}
+}
+
+#endif
@@ -0,0 +1,84 @@
+﻿#include "scanner.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SCANNER_X86
+#endif
+
+//逐字节查找A或B
+template <char A, char B>
+static const char *scan_scalar(const char *p, const char *end)
+{
+    for (; p < end; ++p)
+    {
+        if (*p == A || *p == B)
+            return p;
+    }
+    return end;
+}
+
+#ifdef SCANNER_X86
+//pcmpestri以{A, B}为字符集做EQUAL_ANY比较，返回16字节中第一个命中的下标，没有命中时为16
+template <char A, char B>
+__attribute__((target("sse4.2"))) static const char *scan_sse42(const char *p, const char *end)
+{
+    const __m128i set = _mm_setr_epi8(A, B, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+    while (end - p >= 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)p);
+        int i = _mm_cmpestri(set, 2, v, 16, _SIDD_UBYTE_OPS | _SIDD_CMP_EQUAL_ANY | _SIDD_LEAST_SIGNIFICANT);
+        if (i < 16)
+            return p + i;
+        p += 16;
+    }
+    return scan_scalar<A, B>(p, end);
+}
+
+//每次比较32字节，两个字符的比较结果或起来取掩码，最低的置位就是第一个命中的字节
+template <char A, char B>
+__attribute__((target("avx2"))) static const char *scan_avx2(const char *p, const char *end)
+{
+    const __m256i a = _mm256_set1_epi8(A);
+    const __m256i b = _mm256_set1_epi8(B);
+    while (end - p >= 32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i *)p);
+        unsigned int mask = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, a), _mm256_cmpeq_epi8(v, b)));
+        if (mask)
+            return p + __builtin_ctz(mask);
+        p += 32;
+    }
+    //剩下不足32字节，支持AVX2的CPU都支持SSE4.2
+    return scan_sse42<A, B>(p, end);
+}
+#endif
+
+const scanner::ops scanner::m_impls[] = {
+    {"scalar", scan_scalar<'\r', '\n'>, scan_scalar<' ', '\t'>},
+#ifdef SCANNER_X86
+    {"sse4.2", scan_sse42<'\r', '\n'>, scan_sse42<' ', '\t'>},
+    {"avx2", scan_avx2<'\r', '\n'>, scan_avx2<' ', '\t'>},
+#endif
+};
+
+scanner::LEVEL scanner::best()
+{
+#ifdef SCANNER_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return AVX2;
+    if (__builtin_cpu_supports("sse4.2"))
+        return SSE42;
+#endif
+    return SCALAR;
+}
+
+void scanner::select(LEVEL level)
+{
+    if (level > best())
+        level = best();
+    m_ops = &m_impls[level];
+}
+
+//静态初始化时选好实现，解析时只多一次间接调用
+const scanner::ops *scanner::m_ops = &scanner::m_impls[scanner::best()];
@@ -0,0 +1,51 @@
+﻿#ifndef SCANNER_H
+#define SCANNER_H
+
+// 请求报文的字节扫描
+// 按CPU在运行时选择实现：AVX2每次比较32字节，SSE4.2用pcmpestri每次比较16字节，否则逐字节比较。
+// 所有函数只读[p, end)，找不到时返回end，调用者可以从返回的位置继续扫描，
+// 请求分多次读入时不需要重新扫描已经看过的数据。
+class scanner
+{
+public:
+    typedef const char *(*scan_fn)(const char *p, const char *end);
+
+    //第一个\r或\n
+    static const char *line_end(const char *p, const char *end)
+    {
+        return m_ops->line_end(p, end);
+    }
+    //第一个空格或\t
+    static const char *space(const char *p, const char *end)
+    {
+        return m_ops->space(p, end);
+    }
+
+    //实现等级，SCALAR逐字节，SSE42和AVX2为向量化实现
+    enum LEVEL
+    {
+        SCALAR = 0,
+        SSE42,
+        AVX2
+    };
+    //CPU支持的最高等级
+    static LEVEL best();
+    //指定使用的实现，超出CPU支持时退回best()，供基准测试比较各实现
+    static void select(LEVEL level);
+    static const char *name()
+    {
+        return m_ops->name;
+    }
+
+private:
+    struct ops
+    {
+        const char *name;
+        scan_fn line_end;
+        scan_fn space;
+    };
+    static const ops m_impls[];     //按LEVEL排列的各实现
+    static const ops *m_ops;        //当前使用的实现
+};
+
+#endif
@@ -0,0 +1,37 @@
+﻿#include <stddef.h>
+#include "alloc_stat.h"
+
+extern "C"
+{
+    void *__libc_malloc(size_t size);
+    void *__libc_calloc(size_t nmemb, size_t size);
+    void *__libc_realloc(void *ptr, size_t size);
+}
+
+static unsigned long g_alloc_count = 0;
+
+unsigned long alloc_count()
+{
+    return __atomic_load_n(&g_alloc_count, __ATOMIC_RELAXED);
+}
+
+extern "C"
+{
+    void *malloc(size_t size)
+    {
+        __atomic_fetch_add(&g_alloc_count, 1, __ATOMIC_RELAXED);
+        return __libc_malloc(size);
+    }
+
+    void *calloc(size_t nmemb, size_t size)
+    {
+        __atomic_fetch_add(&g_alloc_count, 1, __ATOMIC_RELAXED);
+        return __libc_calloc(nmemb, size);
+    }
+
+    void *realloc(void *ptr, size_t size)
+    {
+        __atomic_fetch_add(&g_alloc_count, 1, __ATOMIC_RELAXED);
+        return __libc_realloc(ptr, size);
+    }
+}
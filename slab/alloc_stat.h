@@ -0,0 +1,12 @@
+﻿#ifndef ALLOC_STAT_H
+#define ALLOC_STAT_H
+
+// 堆分配计数
+// alloc_stat.cpp在可执行文件中重新定义了malloc、calloc、realloc，计数后转调glibc的__libc_*实现，
+// new和第三方库的分配也都经过这里。事件循环定时打印每个周期的请求数和分配次数，
+// 长连接稳定运行时分配次数应为0。
+// 每次分配都要原子地加同一个计数器，只在统计用的构建中链接：make server_stat编译出定义了
+// ALLOC_STAT的server，默认的server不包含这个文件。
+unsigned long alloc_count();
+
+#endif
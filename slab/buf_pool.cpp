@@ -0,0 +1,149 @@
+﻿#include "buf_pool.h"
+#include "../lock/locker.h"
+
+//每个线程的空闲链表
+struct buf_cache
+{
+    buf_seg *free_list[buf_pool::NUM_CLASS];
+    int count[buf_pool::NUM_CLASS];
+
+    buf_cache()
+    {
+        for (int i = 0; i < buf_pool::NUM_CLASS; ++i)
+        {
+            free_list[i] = NULL;
+            count[i] = 0;
+        }
+    }
+    ~buf_cache()
+    {
+        for (int i = 0; i < buf_pool::NUM_CLASS; ++i)
+        {
+            while (free_list[i])
+            {
+                buf_seg *seg = free_list[i];
+                free_list[i] = seg->next;
+                ::free(seg);
+            }
+        }
+    }
+};
+
+static thread_local buf_cache t_cache;
+
+//所有线程共享的空闲链表
+static buf_seg *g_free_list[buf_pool::NUM_CLASS];
+static int g_count[buf_pool::NUM_CLASS];
+static locker g_lock;
+
+//线程缓存为空时从全局链表取回一批
+static void refill(int cls)
+{
+    g_lock.lock();
+    for (int i = 0; i < buf_pool::BATCH && g_free_list[cls]; ++i)
+    {
+        buf_seg *seg = g_free_list[cls];
+        g_free_list[cls] = seg->next;
+        --g_count[cls];
+        seg->next = t_cache.free_list[cls];
+        t_cache.free_list[cls] = seg;
+        ++t_cache.count[cls];
+    }
+    g_lock.unlock();
+}
+
+//线程缓存满时转出一批到全局链表，全局链表也满时还给系统
+static void flush(int cls)
+{
+    g_lock.lock();
+    for (int i = 0; i < buf_pool::BATCH && t_cache.free_list[cls]; ++i)
+    {
+        buf_seg *seg = t_cache.free_list[cls];
+        t_cache.free_list[cls] = seg->next;
+        --t_cache.count[cls];
+        if (g_count[cls] >= buf_pool::MAX_SHARED)
+        {
+            ::free(seg);
+            continue;
+        }
+        seg->next = g_free_list[cls];
+        g_free_list[cls] = seg;
+        ++g_count[cls];
+    }
+    g_lock.unlock();
+}
+
+//size所在的级别，超出最大级别返回-1
+static int size_class(int size)
+{
+    int cls = 0;
+    int cap = buf_pool::MIN_SIZE;
+    while (cap < size)
+    {
+        cap <<= 1;
+        if (++cls >= buf_pool::NUM_CLASS)
+            return -1;
+    }
+    return cls;
+}
+
+int buf_pool::round_up(int size)
+{
+    int cls = size_class(size);
+    if (cls < 0)
+        return size;
+    return MIN_SIZE << cls;
+}
+
+buf_seg *buf_pool::alloc(int size)
+{
+    int cls = size_class(size);
+    buf_seg *seg = NULL;
+    if (cls >= 0)
+    {
+        size = MIN_SIZE << cls;
+        if (!t_cache.free_list[cls])
+            refill(cls);
+        seg = t_cache.free_list[cls];
+        if (seg)
+        {
+            t_cache.free_list[cls] = seg->next;
+            --t_cache.count[cls];
+        }
+    }
+    if (!seg)
+    {
+        seg = (buf_seg *)malloc(sizeof(buf_seg) + size);
+        if (!seg)
+            return NULL;
+        seg->size = size;
+        seg->cls = cls;
+    }
+    seg->next = NULL;
+    return seg;
+}
+
+void buf_pool::free(buf_seg *seg)
+{
+    int cls = seg->cls;
+    if (cls < 0)
+    {
+        ::free(seg);
+        return;
+    }
+    if (t_cache.count[cls] >= MAX_CACHED)
+        flush(cls);
+    seg->next = t_cache.free_list[cls];
+    t_cache.free_list[cls] = seg;
+    ++t_cache.count[cls];
+}
+
+void buf_pool::free_chain(buf_seg *head)
+{
+    while (head)
+    {
+        buf_seg *next = head->next;
+        free(head);
+        head = next;
+    }
+}
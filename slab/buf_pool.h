@@ -0,0 +1,45 @@
+﻿#ifndef BUF_POOL_H
+#define BUF_POOL_H
+
+#include <stdlib.h>
+
+// 缓冲区段，多个段用next串成链
+// 段头后面紧跟size字节的数据区
+struct buf_seg
+{
+    buf_seg *next;
+    int size;       //数据区大小
+    int cls;        //所属大小级别，-1表示超出最大级别、直接malloc的段
+
+    char *data()
+    {
+        return (char *)(this + 1);
+    }
+};
+
+// 按大小分级的缓冲区段池
+// 级别为2KB、4KB ... 64KB，每个线程各有一份空闲链表，分配和释放都不加锁；
+// 段可以在一个线程分配、在另一个线程释放(Reactor模式下读和写可能在不同的工作线程)，
+// 所以线程缓存超过MAX_CACHED时把BATCH个段转到加锁的全局链表，缓存空了再从全局链表批量取回，
+// 各线程之间不均衡时也不需要向系统申请。全局链表每级最多MAX_SHARED个段，多出的才还给系统。
+class buf_pool
+{
+public:
+    static const int MIN_SIZE = 2048;
+    static const int NUM_CLASS = 6;
+    static const int MAX_SIZE = MIN_SIZE << (NUM_CLASS - 1);
+    static const int MAX_CACHED = 16;
+    static const int BATCH = 8;
+    static const int MAX_SHARED = 1024;
+
+    //分配数据区不小于size的段，大于MAX_SIZE的按实际大小申请
+    static buf_seg *alloc(int size);
+    //释放单个段
+    static void free(buf_seg *seg);
+    //释放整条链
+    static void free_chain(buf_seg *head);
+    //size向上取整后的实际数据区大小
+    static int round_up(int size);
+};
+
+#endif
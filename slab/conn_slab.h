@@ -0,0 +1,152 @@
+﻿#ifndef CONN_SLAB_H
+#define CONN_SLAB_H
+
+#include <new>
+#include <vector>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include "../lock/locker.h"
+
+// 连接对象池
+// 对象按块(chunk)用mmap申请，块内对象在第一次分配时才构造，之前不写入也就不产生缺页，常驻内存随实际并发增长；
+// 关闭的连接放回空闲链表，后进先出，新连接优先复用还在缓存里的对象。
+// m_table以fd为下标保存对象指针，按fd查找是O(1)，且不需要加锁。
+// huge_page为true时优先用2MB大页申请块，失败则退回普通页并建议内核使用透明大页。
+template <typename T>
+class conn_slab
+{
+public:
+    conn_slab(int max_fd, bool huge_page = false);
+    ~conn_slab();
+
+    //按fd查找，没有分配时返回NULL
+    T *get(int fd)
+    {
+        return m_table[fd];
+    }
+    //为fd分配对象，fd上已有对象时直接返回，空间不足时返回NULL
+    T *alloc(int fd);
+    //fd关闭后把对象放回空闲链表
+    void release(int fd);
+    //正在使用的对象数
+    int in_use()
+    {
+        return m_in_use;
+    }
+
+private:
+    //申请一个新的块，其中的对象在alloc时依次构造
+    bool grow();
+
+private:
+    static const size_t CHUNK_BYTES = 2 * 1024 * 1024;     //块大小，与大页大小一致
+
+    int m_max_fd;
+    bool m_huge_page;
+    T **m_table;                    //fd -> 对象
+    std::vector<T *> m_free;        //空闲对象
+    std::vector<void *> m_chunks;   //已申请的块，析构时释放
+    char *m_next;                   //最后一个块中下一个还没构造的对象
+    char *m_end;                    //最后一个块的末尾
+    int m_in_use;
+    locker m_lock;                  //多个事件循环同时分配和释放
+};
+
+template <typename T>
+conn_slab<T>::conn_slab(int max_fd, bool huge_page) : m_max_fd(max_fd), m_huge_page(huge_page), m_next(NULL), m_end(NULL), m_in_use(0)
+{
+    //大数组calloc时直接mmap零页，同样是用到才占用内存
+    m_table = (T **)calloc(max_fd, sizeof(T *));
+    if (!m_table)
+        throw std::exception();
+}
+
+template <typename T>
+conn_slab<T>::~conn_slab()
+{
+    //前面的块都已经构造满，最后一个块只构造到m_next
+    for (size_t i = 0; i < m_chunks.size(); ++i)
+    {
+        T *objs = (T *)m_chunks[i];
+        size_t count = i + 1 < m_chunks.size() ? CHUNK_BYTES / sizeof(T) : (m_next - (char *)objs) / sizeof(T);
+        for (size_t j = 0; j < count; ++j)
+            objs[j].~T();
+        munmap(m_chunks[i], CHUNK_BYTES);
+    }
+    free(m_table);
+}
+
+template <typename T>
+bool conn_slab<T>::grow()
+{
+    void *chunk = MAP_FAILED;
+    if (m_huge_page)
+        chunk = mmap(NULL, CHUNK_BYTES, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (chunk == MAP_FAILED)
+    {
+        chunk = mmap(NULL, CHUNK_BYTES, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (chunk == MAP_FAILED)
+            return false;
+        //没有预留大页时交给透明大页
+        if (m_huge_page)
+            madvise(chunk, CHUNK_BYTES, MADV_HUGEPAGE);
+    }
+    m_chunks.push_back(chunk);
+
+    //对象从低地址开始依次构造，这里不写入块中的任何一页
+    size_t count = CHUNK_BYTES / sizeof(T);
+    m_next = (char *)chunk;
+    m_end = m_next + count * sizeof(T);
+    //空闲链表预留所有对象的位置，release时不再扩容
+    m_free.reserve(m_chunks.size() * count);
+    return true;
+}
+
+template <typename T>
+T *conn_slab<T>::alloc(int fd)
+{
+    if (fd < 0 || fd >= m_max_fd)
+        return NULL;
+    if (m_table[fd])
+        return m_table[fd];
+
+    m_lock.lock();
+    T *obj;
+    if (!m_free.empty())
+    {
+        //优先复用关闭的连接留下的对象，还在缓存里
+        obj = m_free.back();
+        m_free.pop_back();
+    }
+    else
+    {
+        if (m_next == m_end && !grow())
+        {
+            m_lock.unlock();
+            return NULL;
+        }
+        obj = new (m_next) T;
+        m_next += sizeof(T);
+    }
+    ++m_in_use;
+    m_lock.unlock();
+
+    m_table[fd] = obj;
+    return obj;
+}
+
+template <typename T>
+void conn_slab<T>::release(int fd)
+{
+    T *obj = m_table[fd];
+    if (!obj)
+        return;
+    m_table[fd] = NULL;
+
+    m_lock.lock();
+    m_free.push_back(obj);
+    --m_in_use;
+    m_lock.unlock();
+}
+
+#endif
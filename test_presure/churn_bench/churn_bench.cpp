@@ -0,0 +1,119 @@
+﻿// 连接频繁建立和关闭时定时器的开销
+// 模拟事件循环处理短连接：每个新连接设置定时器、刷新几次，然后由对端关闭(取消定时器)或超时关闭(tick回调)。
+// 比较两种定时器结点：每个连接new一个、关闭时delete(原来的做法)，和嵌在连接对象中的结点(conn_slot::timer)。
+// 链接slab/alloc_stat.cpp统计malloc次数，嵌入结点时应为0。
+// 用法: ./churn_bench [连接数] [并发数]
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <netinet/in.h>
+#include <vector>
+
+#include "../../timer/timing_wheel.h"
+#include "../../slab/alloc_stat.h"
+
+//对应conn_slot，省去http_conn
+struct slot
+{
+    client_data data;
+    util_timer timer;
+};
+
+static bool heap_nodes = false;
+static long closed_by_timer = 0;
+
+static unsigned long long seed = 88172645463325252ULL;
+static unsigned rnd()
+{
+    seed ^= seed << 13;
+    seed ^= seed >> 7;
+    seed ^= seed << 17;
+    return (unsigned)seed;
+}
+
+//超时关闭，和eventloop的cb_func一样清掉client_data::timer
+static void cb_func(client_data *user_data)
+{
+    ++closed_by_timer;
+    if (heap_nodes)
+        delete user_data->timer;
+    user_data->timer = NULL;
+}
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void run(bool heap, int n, int concurrency)
+{
+    heap_nodes = heap;
+    closed_by_timer = 0;
+    seed = 88172645463325252ULL;
+    time_t fake_now = monotonic_ms();
+    timing_wheel *timers = new timing_wheel;
+    std::vector<slot> conns(concurrency);
+    for (int i = 0; i < concurrency; ++i)
+        conns[i].data.timer = NULL;
+
+    unsigned long allocs = alloc_count();
+    double t = now();
+    for (int i = 0; i < n; ++i)
+    {
+        //每10个连接过去1毫秒
+        if (i % 10 == 0)
+            timers->tick(++fake_now);
+        int fd = rnd() % concurrency;
+        client_data *data = &conns[fd].data;
+        //fd上还有连接时先由对端关闭
+        if (data->timer)
+        {
+            util_timer *timer = data->timer;
+            timers->del_timer(timer);
+            if (heap)
+                delete timer;
+            data->timer = NULL;
+        }
+        //新连接，和eventloop::init_timer一样
+        util_timer *timer = heap ? new util_timer : &conns[fd].timer;
+        data->sockfd = fd;
+        timer->user_data = data;
+        timer->cb_func = cb_func;
+        //四分之一的连接不发请求，很快超时，由tick关闭
+        bool idle = rnd() % 4 == 0;
+        timer->expire = fake_now + (idle ? 5 : 10000);
+        data->timer = timer;
+        timers->add_timer(timer);
+        //其余连接收到请求和发完响应各刷新一次
+        for (int j = 0; j < 2 && !idle; ++j)
+        {
+            timer->expire = fake_now + (j ? 15000 : 10000);
+            timers->adjust_timer(timer);
+        }
+    }
+    double elapsed = now() - t;
+    allocs = alloc_count() - allocs;
+    fprintf(stderr, "%-10s conns=%-8d %6.1f ns/conn  timeout closes %-7ld allocs %lu (%.2f/conn)\n",
+            heap ? "new/delete" : "intrusive", n, elapsed * 1e9 / n, closed_by_timer, allocs, (double)allocs / n);
+
+    for (int i = 0; i < concurrency; ++i)
+        if (conns[i].data.timer)
+        {
+            timers->del_timer(conns[i].data.timer);
+            if (heap)
+                delete conns[i].data.timer;
+        }
+    delete timers;
+}
+
+int main(int argc, char *argv[])
+{
+    int n = argc > 1 ? atoi(argv[1]) : 1000000;
+    int concurrency = argc > 2 ? atoi(argv[2]) : 1000;
+    run(true, n, concurrency);
+    run(false, n, concurrency);
+    return 0;
+}
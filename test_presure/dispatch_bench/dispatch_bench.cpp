@@ -0,0 +1,243 @@
+﻿// 线程池调度方式的基准
+// 若干生产者线程(事件循环)各自负责一部分连接，连接上一个请求处理完才会发出下一个(与EPOLLONESHOT一致)；
+// 工作线程处理请求时读写该连接的状态(模拟http_conn和它的读写缓冲区)。
+// 分别用scheduler的三种调度方式运行，输出吞吐量、LLC未命中数(perf_event，不可用时为n/a)、
+// 各工作线程的处理数、窃取数和采样到的最大/平均排队数，以及亲和方式下的改投次数。
+// skewed一组让fd为8的倍数的连接处理开销是其他连接的8倍，亲和方式下这些连接集中在少数工作线程上。
+// 用法: ./dispatch_bench [请求数] [工作线程数] [生产者数] [连接数] [每个连接的状态KB]
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "../../threadpool/scheduler.h"
+
+struct conn
+{
+    int fd;
+    int busy;           //请求已入队还没处理完
+    unsigned long sum;
+    char *state;
+};
+
+//让工作线程退出的请求，scheduler中不能放NULL
+static conn stop_conn;
+
+struct bench
+{
+    scheduler<conn> *sched;
+    conn *conns;
+    int nconn;
+    int producers;
+    long per_producer;
+    int state_bytes;
+    bool skewed;
+    int next_worker;
+};
+
+struct producer_arg
+{
+    bench *b;
+    int id;
+};
+
+static void *producer(void *arg)
+{
+    producer_arg *pa = (producer_arg *)arg;
+    bench *b = pa->b;
+    long sent = 0;
+    while (sent < b->per_producer)
+    {
+        bool any = false;
+        for (int i = pa->id; i < b->nconn && sent < b->per_producer; i += b->producers)
+        {
+            conn *c = &b->conns[i];
+            if (__atomic_load_n(&c->busy, __ATOMIC_ACQUIRE))
+                continue;
+            c->busy = 1;
+            if (!b->sched->push(c, c->fd))
+            {
+                c->busy = 0;
+                continue;
+            }
+            ++sent;
+            any = true;
+        }
+        if (!any)
+            sched_yield();
+    }
+    return NULL;
+}
+
+//读写连接状态的每个缓存行，开销大的连接多做几遍
+static void handle(bench *b, conn *c)
+{
+    int rounds = b->skewed && c->fd % 8 == 0 ? 8 : 1;
+    unsigned long sum = c->sum;
+    for (int r = 0; r < rounds; ++r)
+        for (int i = 0; i < b->state_bytes; i += 64)
+        {
+            sum += (unsigned char)c->state[i];
+            c->state[i] = (char)sum;
+        }
+    c->sum = sum;
+}
+
+static void *worker(void *arg)
+{
+    bench *b = (bench *)arg;
+    int id = __atomic_fetch_add(&b->next_worker, 1, __ATOMIC_RELAXED);
+    while (1)
+    {
+        conn *c = b->sched->pop(id);
+        if (c == &stop_conn)
+            break;
+        handle(b, c);
+        __atomic_store_n(&c->busy, 0, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+//LLC未命中计数，inherit使之后创建的线程也计入
+static int open_llc_counter()
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    attr.disabled = 1;
+    attr.inherit = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void run(int policy, bool skewed, long requests, int workers, int producers, int nconn, int state_kb)
+{
+    static const char *names[] = {"shared", "steal", "affinity"};
+    bench b;
+    b.sched = new scheduler<conn>(policy, workers, 10000);
+    b.nconn = nconn;
+    b.producers = producers;
+    b.per_producer = requests / producers;
+    b.state_bytes = state_kb * 1024;
+    b.skewed = skewed;
+    b.next_worker = 0;
+    b.conns = new conn[nconn];
+    char *state = new char[(size_t)nconn * b.state_bytes];
+    memset(state, 0, (size_t)nconn * b.state_bytes);
+    for (int i = 0; i < nconn; ++i)
+    {
+        //fd从较小的整数开始连续分配，与服务器中一样
+        b.conns[i].fd = i + 8;
+        b.conns[i].busy = 0;
+        b.conns[i].sum = 0;
+        b.conns[i].state = state + (size_t)i * b.state_bytes;
+    }
+
+    int fd = open_llc_counter();
+    if (fd >= 0)
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+    pthread_t *threads = new pthread_t[workers + producers];
+    producer_arg *args = new producer_arg[producers];
+    double t = now();
+    for (int i = 0; i < workers; ++i)
+        pthread_create(threads + i, NULL, worker, &b);
+    for (int i = 0; i < producers; ++i)
+    {
+        args[i].b = &b;
+        args[i].id = i;
+        pthread_create(threads + workers + i, NULL, producer, args + i);
+    }
+
+    //主线程定时采样各工作线程的排队数，直到请求全部处理完
+    long total = b.per_producer * producers;
+    int *max_depth = new int[workers];
+    double *sum_depth = new double[workers];
+    long samples = 0;
+    for (int i = 0; i < workers; ++i)
+    {
+        max_depth[i] = 0;
+        sum_depth[i] = 0;
+    }
+    while (1)
+    {
+        long done = 0;
+        for (int i = 0; i < workers; ++i)
+        {
+            done += b.sched->processed(i);
+            int d = b.sched->depth(i);
+            if (d > max_depth[i])
+                max_depth[i] = d;
+            sum_depth[i] += d;
+        }
+        ++samples;
+        if (done >= total)
+            break;
+        usleep(100);
+    }
+    double elapsed = now() - t;
+    for (int i = 0; i < producers; ++i)
+        pthread_join(threads[workers + i], NULL);
+    //每个工作线程收到一个stop_conn后退出，key取i让亲和方式下正好每个线程一个
+    for (int i = 0; i < workers; ++i)
+        while (!b.sched->push(&stop_conn, i))
+            sched_yield();
+    for (int i = 0; i < workers; ++i)
+        pthread_join(threads[i], NULL);
+
+    long long misses = -1;
+    if (fd >= 0)
+    {
+        ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+        if (read(fd, &misses, sizeof(misses)) != sizeof(misses))
+            misses = -1;
+        close(fd);
+    }
+    char llc[32];
+    if (misses >= 0)
+        snprintf(llc, sizeof(llc), "%.2f", (double)misses / total);
+    else
+        snprintf(llc, sizeof(llc), "n/a");
+    fprintf(stderr, "%-8s %-7s %7.3f M req/s  LLC misses/req %s  rebalanced %lu\n", names[policy],
+            skewed ? "skewed" : "uniform", total / elapsed / 1e6, llc, b.sched->rebalanced());
+    fprintf(stderr, "  worker  processed    stolen  max depth  avg depth\n");
+    for (int i = 0; i < workers; ++i)
+        fprintf(stderr, "  %6d %10lu %9lu %10d %10.2f\n", i, b.sched->processed(i) - 1, b.sched->stolen(i),
+                max_depth[i], sum_depth[i] / samples);
+
+    delete[] max_depth;
+    delete[] sum_depth;
+    delete[] args;
+    delete[] threads;
+    delete[] state;
+    delete[] b.conns;
+    delete b.sched;
+}
+
+int main(int argc, char *argv[])
+{
+    long requests = argc > 1 ? atol(argv[1]) : 1000000;
+    int workers = argc > 2 ? atoi(argv[2]) : 8;
+    int producers = argc > 3 ? atoi(argv[3]) : 2;
+    int nconn = argc > 4 ? atoi(argv[4]) : 4096;
+    int state_kb = argc > 5 ? atoi(argv[5]) : 8;
+    for (int skewed = 0; skewed < 2; ++skewed)
+        for (int policy = SCHED_SHARED; policy <= SCHED_AFFINITY; ++policy)
+            run(policy, skewed, requests, workers, producers, nconn, state_kb);
+    return 0;
+}
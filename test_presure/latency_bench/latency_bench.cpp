@@ -0,0 +1,210 @@
+﻿// 长连接的吞吐量和延迟分布
+// 单线程epoll客户端，每个连接发出一个请求，收完整个响应(按Content-Length)后立刻发下一个，
+// 每个请求的延迟从发送到收完响应。webbench每个请求都新建连接，也不统计延迟，这里补上这两点。
+// 可以另开几个连接反复下载一个大文件，观察大文件发送对其他请求延迟的影响，大文件的请求单独统计。
+// 服务器关闭连接时重新连接，计入重连次数。
+// 用法: ./latency_bench ip port 路径 连接数 秒数 [大文件路径 大文件连接数]
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+struct client
+{
+    int fd;
+    bool big;               //是否是下载大文件的连接
+    bool connected;
+    std::string head;       //还没收完的响应头
+    long remaining;         //响应正文还没收到的字节数，-1表示响应头还没收完
+    double start;           //当前请求的发送时间
+};
+
+struct stat_set
+{
+    std::vector<double> latency;    //微秒
+    long bytes;
+    long reconnects;
+};
+
+static sockaddr_in g_addr;
+static std::string g_small_req, g_big_req;
+static int g_epollfd;
+static char g_buf[256 * 1024];
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void open_client(client *c)
+{
+    c->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    int one = 1;
+    setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    c->connected = false;
+    c->head.clear();
+    c->remaining = -1;
+    if (connect(c->fd, (sockaddr *)&g_addr, sizeof(g_addr)) < 0 && errno != EINPROGRESS)
+    {
+        perror("connect");
+        exit(1);
+    }
+    epoll_event ev;
+    ev.events = EPOLLIN | EPOLLOUT;
+    ev.data.ptr = c;
+    epoll_ctl(g_epollfd, EPOLL_CTL_ADD, c->fd, &ev);
+}
+
+static void reopen_client(client *c, stat_set *st)
+{
+    epoll_ctl(g_epollfd, EPOLL_CTL_DEL, c->fd, NULL);
+    close(c->fd);
+    ++st->reconnects;
+    open_client(c);
+}
+
+//请求很短，一次send就能发完
+static bool send_request(client *c)
+{
+    const std::string &req = c->big ? g_big_req : g_small_req;
+    c->head.clear();
+    c->remaining = -1;
+    c->start = now();
+    return send(c->fd, req.data(), req.size(), MSG_NOSIGNAL) == (ssize_t)req.size();
+}
+
+//处理收到的数据，一个响应收完时返回true
+static bool consume(client *c, const char *data, long n, stat_set *st)
+{
+    st->bytes += n;
+    if (c->remaining < 0)
+    {
+        c->head.append(data, n);
+        size_t end = c->head.find("\r\n\r\n");
+        if (end == std::string::npos)
+            return false;
+        long length = 0;
+        size_t pos = 0;
+        while ((pos = c->head.find("\r\n", pos)) != std::string::npos && pos < end)
+        {
+            pos += 2;
+            if (strncasecmp(c->head.c_str() + pos, "Content-Length:", 15) == 0)
+                length = atol(c->head.c_str() + pos + 15);
+        }
+        c->remaining = length - (long)(c->head.size() - end - 4);
+    }
+    else
+        c->remaining -= n;
+    return c->remaining <= 0;
+}
+
+static void print_stats(const char *name, stat_set *st, double elapsed)
+{
+    std::vector<double> &v = st->latency;
+    if (v.empty())
+    {
+        printf("%-6s no complete responses, reconnects %ld\n", name, st->reconnects);
+        return;
+    }
+    std::sort(v.begin(), v.end());
+    size_t n = v.size();
+    printf("%-6s requests %zu  %.0f req/s  %.1f MB/s  latency us p50 %.0f  p99 %.0f  p99.9 %.0f  max %.0f  reconnects %ld\n",
+           name, n, n / elapsed, st->bytes / elapsed / 1e6, v[n / 2], v[n * 99 / 100], v[n * 999 / 1000], v[n - 1],
+           st->reconnects);
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 6)
+    {
+        printf("usage: %s ip port path conns seconds [big_path big_conns]\n", argv[0]);
+        return 1;
+    }
+    memset(&g_addr, 0, sizeof(g_addr));
+    g_addr.sin_family = AF_INET;
+    g_addr.sin_port = htons(atoi(argv[2]));
+    inet_pton(AF_INET, argv[1], &g_addr.sin_addr);
+    int nsmall = atoi(argv[4]);
+    double seconds = atof(argv[5]);
+    int nbig = argc >= 8 ? atoi(argv[7]) : 0;
+    g_small_req = std::string("GET ") + argv[3] + " HTTP/1.1\r\nHost: bench\r\nConnection: keep-alive\r\n\r\n";
+    if (nbig > 0)
+        g_big_req = std::string("GET ") + argv[6] + " HTTP/1.1\r\nHost: bench\r\nConnection: keep-alive\r\n\r\n";
+
+    g_epollfd = epoll_create1(0);
+    std::vector<client> clients(nsmall + nbig);
+    stat_set stats[2];
+    for (int i = 0; i < 2; ++i)
+    {
+        stats[i].bytes = 0;
+        stats[i].reconnects = 0;
+    }
+    for (int i = 0; i < nsmall + nbig; ++i)
+    {
+        clients[i].big = i >= nsmall;
+        open_client(&clients[i]);
+    }
+
+    epoll_event events[1024];
+    double begin = now(), end = begin + seconds;
+    while (now() < end)
+    {
+        int n = epoll_wait(g_epollfd, events, 1024, 100);
+        for (int i = 0; i < n; ++i)
+        {
+            client *c = (client *)events[i].data.ptr;
+            stat_set *st = &stats[c->big];
+            //连接建立后只关心读事件
+            if (!c->connected && (events[i].events & EPOLLOUT))
+            {
+                c->connected = true;
+                epoll_event ev;
+                ev.events = EPOLLIN;
+                ev.data.ptr = c;
+                epoll_ctl(g_epollfd, EPOLL_CTL_MOD, c->fd, &ev);
+                if (!send_request(c))
+                    reopen_client(c, st);
+                continue;
+            }
+            while (1)
+            {
+                ssize_t r = recv(c->fd, g_buf, sizeof(g_buf), 0);
+                if (r < 0 && errno == EAGAIN)
+                    break;
+                if (r <= 0)
+                {
+                    reopen_client(c, st);
+                    break;
+                }
+                if (consume(c, g_buf, r, st))
+                {
+                    st->latency.push_back((now() - c->start) * 1e6);
+                    if (!send_request(c))
+                    {
+                        reopen_client(c, st);
+                        break;
+                    }
+                }
+            }
+        }
+    }
+    double elapsed = now() - begin;
+    print_stats("small", &stats[0], elapsed);
+    if (nbig > 0)
+        print_stats("big", &stats[1], elapsed);
+    return 0;
+}
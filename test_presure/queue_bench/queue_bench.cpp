@@ -0,0 +1,160 @@
+﻿// 线程池请求队列的微基准
+// 比较原来的互斥锁+信号量环形数组和无锁队列mpmc_queue：若干生产者(事件循环)不断入队，
+// 若干消费者(工作线程)取出后立即丢弃，统计每秒处理的请求数，并检查取出的总数与校验和。
+// 用法: ./queue_bench [每个生产者的请求数]
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include "../../lock/locker.h"
+#include "../../threadpool/mpmc_queue.h"
+
+static const int QUEUE_SIZE = 10000;    //与threadpool的max_requests默认值相同
+
+//原来threadpool中的请求队列
+class locked_queue
+{
+public:
+    locked_queue(int capacity) : m_capacity(capacity), m_head(0), m_size(0)
+    {
+        m_queue = new void *[capacity];
+    }
+    ~locked_queue()
+    {
+        delete[] m_queue;
+    }
+    bool push(void *data)
+    {
+        m_lock.lock();
+        if (m_size >= m_capacity)
+        {
+            m_lock.unlock();
+            return false;
+        }
+        m_queue[(m_head + m_size) % m_capacity] = data;
+        ++m_size;
+        m_lock.unlock();
+        m_stat.post();
+        return true;
+    }
+    void *pop()
+    {
+        while (1)
+        {
+            m_stat.wait();
+            m_lock.lock();
+            if (m_size == 0)
+            {
+                m_lock.unlock();
+                continue;
+            }
+            void *data = m_queue[m_head];
+            m_head = (m_head + 1) % m_capacity;
+            --m_size;
+            m_lock.unlock();
+            return data;
+        }
+    }
+
+private:
+    void **m_queue;
+    int m_capacity;
+    int m_head;
+    int m_size;
+    locker m_lock;
+    sem m_stat;
+};
+
+template <class Q>
+struct bench
+{
+    Q *queue;
+    long per_producer;
+    long popped;
+    unsigned long sum;
+};
+
+template <class Q>
+static void *producer(void *arg)
+{
+    bench<Q> *b = (bench<Q> *)arg;
+    for (long i = 1; i <= b->per_producer; ++i)
+        while (!b->queue->push((void *)i))
+            sched_yield();      //队列满，事件循环在这里会直接拒绝，基准中重试
+    return NULL;
+}
+
+template <class Q>
+static void *consumer(void *arg)
+{
+    bench<Q> *b = (bench<Q> *)arg;
+    long popped = 0;
+    unsigned long sum = 0;
+    while (1)
+    {
+        void *data = b->queue->pop();
+        if (!data)
+            break;
+        ++popped;
+        sum += (unsigned long)data;
+    }
+    __sync_fetch_and_add(&b->popped, popped);
+    __sync_fetch_and_add(&b->sum, sum);
+    return NULL;
+}
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+template <class Q>
+static bool run(const char *name, int producers, int consumers, long per_producer)
+{
+    bench<Q> b;
+    b.queue = new Q(QUEUE_SIZE);
+    b.per_producer = per_producer;
+    b.popped = 0;
+    b.sum = 0;
+    pthread_t *threads = new pthread_t[producers + consumers];
+    double t = now();
+    for (int i = 0; i < consumers; ++i)
+        pthread_create(threads + i, NULL, consumer<Q>, &b);
+    for (int i = 0; i < producers; ++i)
+        pthread_create(threads + consumers + i, NULL, producer<Q>, &b);
+    for (int i = 0; i < producers; ++i)
+        pthread_join(threads[consumers + i], NULL);
+    //每个消费者取到一个NULL后退出
+    for (int i = 0; i < consumers; ++i)
+        while (!b.queue->push(NULL))
+            sched_yield();
+    for (int i = 0; i < consumers; ++i)
+        pthread_join(threads[i], NULL);
+    double elapsed = now() - t;
+
+    long total = per_producer * producers;
+    unsigned long sum = (unsigned long)per_producer * (per_producer + 1) / 2 * producers;
+    bool ok = b.popped == total && b.sum == sum;
+    fprintf(stderr, "%-12s producers %2d  consumers %2d  %7.2f M/s  %6.1f ns/op%s\n", name, producers, consumers,
+            total / elapsed / 1e6, elapsed * 1e9 / total, ok ? "" : "  MISMATCH");
+    delete[] threads;
+    delete b.queue;
+    return ok;
+}
+
+int main(int argc, char *argv[])
+{
+    long n = argc > 1 ? atol(argv[1]) : 1000000;
+    const int configs[][2] = {{1, 8}, {4, 8}, {8, 8}, {4, 16}};
+    bool ok = true;
+    for (int i = 0; i < 4; ++i)
+    {
+        ok &= run<locked_queue>("locker+sem", configs[i][0], configs[i][1], n);
+        ok &= run<mpmc_queue<void *> >("mpmc_queue", configs[i][0], configs[i][1], n);
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,127 @@
+﻿// 请求报文扫描的微基准
+// 把典型的浏览器请求按行切分，比较原来逐字节的parse_line+strpbrk和scanner各实现的速度，
+// 并检查各实现切出的行和请求行中的分隔位置完全一致。
+// 用法: ./scan_bench [轮数]
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <string>
+#include "../../http/scanner.h"
+
+static const char *requests[] = {
+    "GET /judge.html HTTP/1.1\r\n"
+    "Host: 127.0.0.1:9006\r\n"
+    "Connection: keep-alive\r\n"
+    "Cache-Control: max-age=0\r\n"
+    "Upgrade-Insecure-Requests: 1\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/120.0.0.0 Safari/537.36\r\n"
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,image/apng,*/*;q=0.8\r\n"
+    "Accept-Encoding: gzip, deflate, br\r\n"
+    "Accept-Language: zh-CN,zh;q=0.9,en;q=0.8\r\n"
+    "\r\n",
+    "GET /favicon.ico HTTP/1.1\r\n"
+    "Host: 127.0.0.1:9006\r\n"
+    "Connection: keep-alive\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/120.0.0.0 Safari/537.36\r\n"
+    "Accept: image/avif,image/webp,image/apng,image/svg+xml,image/*,*/*;q=0.8\r\n"
+    "Referer: http://127.0.0.1:9006/\r\n"
+    "Cookie: session=0123456789abcdef0123456789abcdef; theme=dark; tracking=aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa\r\n"
+    "\r\n",
+    "GET / HTTP/1.1\r\nHost: a\r\n\r\n",
+};
+
+//原来的实现：逐字节找\r\n，请求行用strpbrk找空格
+static int scalar_lines(char *buf, int len, long &sum)
+{
+    int lines = 0, start = 0;
+    for (int i = 0; i < len; ++i)
+    {
+        if (buf[i] == '\r' && i + 1 < len && buf[i + 1] == '\n')
+        {
+            buf[i] = '\0';
+            if (lines == 0)
+            {
+                char *sp = strpbrk(buf + start, " \t");
+                char *sp2 = sp ? strpbrk(sp + 1, " \t") : NULL;
+                sum += (sp ? sp - buf : 0) + (sp2 ? sp2 - buf : 0);
+            }
+            buf[i] = '\r';
+            sum += i;
+            ++lines;
+            start = i + 2;
+            ++i;
+        }
+    }
+    return lines;
+}
+
+static int vector_lines(char *buf, int len, long &sum)
+{
+    int lines = 0, start = 0;
+    const char *end = buf + len;
+    const char *p = buf;
+    while ((p = scanner::line_end(p, end)) != end)
+    {
+        if (*p == '\r' && p + 1 < end && p[1] == '\n')
+        {
+            if (lines == 0)
+            {
+                const char *sp = scanner::space(buf + start, p);
+                const char *sp2 = sp != p ? scanner::space(sp + 1, p) : p;
+                sum += (sp != p ? sp - buf : 0) + (sp2 != p ? sp2 - buf : 0);
+            }
+            sum += p - buf;
+            ++lines;
+            start = p + 2 - buf;
+            p += 2;
+        }
+        else
+            ++p;
+    }
+    return lines;
+}
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char *argv[])
+{
+    long rounds = argc > 1 ? atol(argv[1]) : 2000000;
+    const int n = sizeof(requests) / sizeof(requests[0]);
+    std::string bufs[n];
+    long bytes = 0;
+    for (int i = 0; i < n; ++i)
+    {
+        bufs[i] = requests[i];
+        bytes += bufs[i].size();
+    }
+
+    long expect = 0;
+    double t = now();
+    for (long r = 0; r < rounds; ++r)
+        for (int i = 0; i < n; ++i)
+            scalar_lines(&bufs[i][0], bufs[i].size(), expect);
+    t = now() - t;
+    printf("%-16s %8.1f ns/request %8.2f GB/s\n", "legacy", t * 1e9 / (rounds * n), bytes * rounds / t / 1e9);
+
+    for (int level = scanner::SCALAR; level <= scanner::best(); ++level)
+    {
+        scanner::select((scanner::LEVEL)level);
+        long sum = 0;
+        t = now();
+        for (long r = 0; r < rounds; ++r)
+            for (int i = 0; i < n; ++i)
+                vector_lines(&bufs[i][0], bufs[i].size(), sum);
+        t = now() - t;
+        printf("%-16s %8.1f ns/request %8.2f GB/s%s\n", scanner::name(), t * 1e9 / (rounds * n),
+               bytes * rounds / t / 1e9, sum == expect ? "" : "  MISMATCH");
+        if (sum != expect)
+            return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,129 @@
+﻿// 定时器容器的微基准
+// 比较升序链表sort_timer_lst和分层时间轮timing_wheel在大量长连接下的插入、刷新、删除和到期处理，
+// 并检查两者到期回调的次数一致。链表中的定时器由new申请、由链表释放，时间轮的定时器结点由调用者提供，
+// 这里放在一个数组中，对应服务器里嵌在连接对象中的结点。
+// 时间都按毫秒计，链表用time(NULL)取当前时间，这里换成可控的时钟，时间轮直接把时间传给tick。
+// 用法: ./timer_bench [刷新次数]
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <netinet/in.h>
+#include <vector>
+
+static time_t fake_now = 1000000;
+static time_t bench_time(time_t *)
+{
+    return fake_now;
+}
+#define time bench_time
+#include "../../timer/lst_timer.h"
+#include "../../timer/timing_wheel.h"
+#undef time
+
+static long expired = 0;
+static void count_cb(client_data *)
+{
+    ++expired;
+}
+
+static unsigned long long seed = 88172645463325252ULL;
+static unsigned rnd()
+{
+    seed ^= seed << 13;
+    seed ^= seed >> 7;
+    seed ^= seed << 17;
+    return (unsigned)seed;
+}
+
+//链表释放定时器，每个都要new；时间轮直接用node
+static util_timer *new_timer(sort_timer_lst *, util_timer *)
+{
+    return new util_timer;
+}
+static util_timer *new_timer(timing_wheel *, util_timer *node)
+{
+    return node;
+}
+
+//让所有定时器到期
+static void expire_all(sort_timer_lst *timers)
+{
+    timers->tick();
+}
+static void expire_all(timing_wheel *timers)
+{
+    timers->tick(fake_now);
+}
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+//n个连接，刷新refresh次，再删除一半，最后全部到期
+template <class T>
+static void run(const char *name, int n, int refresh)
+{
+    fake_now = monotonic_ms();
+    seed = 88172645463325252ULL;
+    expired = 0;
+    T *timers = new T;
+    std::vector<util_timer *> all(n);
+    std::vector<client_data> data(n);
+    std::vector<util_timer> nodes(n);
+    double t = now();
+    for (int i = 0; i < n; ++i)
+    {
+        util_timer *timer = new_timer(timers, &nodes[i]);
+        timer->expire = fake_now + 1000 + rnd() % 15000;
+        timer->cb_func = count_cb;
+        timer->user_data = &data[i];
+        all[i] = timer;
+        timers->add_timer(timer);
+    }
+    double t_add = now() - t;
+
+    //有数据传输的连接把超时时间推到最后，和eventloop::adjust_timer一样
+    t = now();
+    for (int i = 0; i < refresh; ++i)
+    {
+        util_timer *timer = all[rnd() % n];
+        timer->expire = fake_now + 15000;
+        timers->adjust_timer(timer);
+    }
+    double t_adjust = now() - t;
+
+    t = now();
+    for (int i = 0; i < n; i += 2)
+        timers->del_timer(all[i]);
+    double t_del = now() - t;
+
+    fake_now += 16000;
+    t = now();
+    expire_all(timers);
+    double t_tick = now() - t;
+    fprintf(stderr, "%-14s n=%-7d add %7.1f  adjust %9.1f  del %6.1f  expire %6.1f ns/op  expired %ld\n", name, n,
+            t_add * 1e9 / n, t_adjust * 1e9 / refresh, t_del * 1e9 / (n / 2), t_tick * 1e9 / (n - n / 2), expired);
+    delete timers;
+}
+
+int main(int argc, char *argv[])
+{
+    int refresh = argc > 1 ? atoi(argv[1]) : 20000;
+    const int sizes[] = {10000, 100000};
+    for (int i = 0; i < 2; ++i)
+    {
+        run<sort_timer_lst>("sort_timer_lst", sizes[i], refresh);
+        long list_expired = expired;
+        run<timing_wheel>("timing_wheel", sizes[i], refresh);
+        if (expired != list_expired)
+        {
+            fprintf(stderr, "MISMATCH\n");
+            return 1;
+        }
+    }
+    return 0;
+}
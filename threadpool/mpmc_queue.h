@@ -0,0 +1,158 @@
+﻿#ifndef MPMC_QUEUE_H
+#define MPMC_QUEUE_H
+
+#include <exception>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+//自旋等待时让出流水线，超线程的另一个线程可以继续执行
+inline void cpu_relax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+// 有界无锁多生产者多消费者队列(Vyukov)
+// 容量取不小于capacity的2的幂，每个槽带一个序号：序号等于入队位置时可写，等于位置+1时可读。
+// 生产者和消费者各自用CAS抢占入队/出队位置，抢到后只写自己的槽，互相之间没有锁，入队出队都不分配内存。
+// 队列为空时消费者先自旋一会儿，仍取不到再在futex上休眠；生产者只在有休眠的消费者时才调用futex唤醒。
+template <typename T>
+class mpmc_queue
+{
+public:
+    explicit mpmc_queue(int capacity) : m_enqueue_pos(0), m_dequeue_pos(0), m_waiters(0), m_futex(0)
+    {
+        if (capacity <= 0 || capacity > INT_MAX / 2)
+            throw std::exception();
+        unsigned size = 1;
+        while (size < (unsigned)capacity)
+            size <<= 1;
+        m_mask = size - 1;
+        m_cells = new cell[size];
+        for (unsigned i = 0; i < size; ++i)
+            m_cells[i].seq = i;
+    }
+    ~mpmc_queue()
+    {
+        delete[] m_cells;
+    }
+
+    //队列满时返回false
+    bool push(T data)
+    {
+        cell *c;
+        unsigned pos = __atomic_load_n(&m_enqueue_pos, __ATOMIC_RELAXED);
+        while (1)
+        {
+            c = &m_cells[pos & m_mask];
+            unsigned seq = __atomic_load_n(&c->seq, __ATOMIC_ACQUIRE);
+            int diff = (int)(seq - pos);
+            if (diff == 0)
+            {
+                //失败时pos被更新为当前的入队位置
+                if (__atomic_compare_exchange_n(&m_enqueue_pos, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                    break;
+            }
+            else if (diff < 0)
+                return false;       //槽还没被上一圈的消费者取走，队列满
+            else
+                pos = __atomic_load_n(&m_enqueue_pos, __ATOMIC_RELAXED);
+        }
+        c->data = data;
+        __atomic_store_n(&c->seq, pos + 1, __ATOMIC_RELEASE);
+
+        //与pop中登记休眠的顺序相反：先发布数据再检查m_waiters，两边之间各有一次全屏障，
+        //消费者要么在休眠前重试时看到这条数据，要么被这里唤醒
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&m_waiters, __ATOMIC_RELAXED) > 0)
+        {
+            __atomic_fetch_add(&m_futex, 1, __ATOMIC_RELAXED);
+            syscall(SYS_futex, &m_futex, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+        }
+        return true;
+    }
+
+    //队列空时返回false，不阻塞
+    bool try_pop(T &data)
+    {
+        cell *c;
+        unsigned pos = __atomic_load_n(&m_dequeue_pos, __ATOMIC_RELAXED);
+        while (1)
+        {
+            c = &m_cells[pos & m_mask];
+            unsigned seq = __atomic_load_n(&c->seq, __ATOMIC_ACQUIRE);
+            int diff = (int)(seq - (pos + 1));
+            if (diff == 0)
+            {
+                if (__atomic_compare_exchange_n(&m_dequeue_pos, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                    break;
+            }
+            else if (diff < 0)
+                return false;       //槽还没有写入，队列空
+            else
+                pos = __atomic_load_n(&m_dequeue_pos, __ATOMIC_RELAXED);
+        }
+        data = c->data;
+        //留给下一圈的生产者
+        __atomic_store_n(&c->seq, pos + m_mask + 1, __ATOMIC_RELEASE);
+        return true;
+    }
+
+    //队列中的元素数，并发读取时只是近似值
+    int size()
+    {
+        int n = (int)(__atomic_load_n(&m_enqueue_pos, __ATOMIC_RELAXED) - __atomic_load_n(&m_dequeue_pos, __ATOMIC_RELAXED));
+        return n > 0 ? n : 0;
+    }
+
+    //取出一个元素，队列空时阻塞
+    T pop()
+    {
+        T data;
+        while (1)
+        {
+            for (int i = 0; i < SPIN; ++i)
+            {
+                if (try_pop(data))
+                    return data;
+                cpu_relax();
+            }
+            //先登记再读取futex的值并重试一次，重试失败后futex值没有变化才真正休眠
+            __atomic_fetch_add(&m_waiters, 1, __ATOMIC_SEQ_CST);
+            __atomic_thread_fence(__ATOMIC_SEQ_CST);
+            unsigned val = __atomic_load_n(&m_futex, __ATOMIC_RELAXED);
+            if (try_pop(data))
+            {
+                __atomic_fetch_sub(&m_waiters, 1, __ATOMIC_RELAXED);
+                return data;
+            }
+            syscall(SYS_futex, &m_futex, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+            __atomic_fetch_sub(&m_waiters, 1, __ATOMIC_RELAXED);
+        }
+    }
+
+private:
+    static const int SPIN = 64;     //休眠前自旋重试的次数
+
+    struct cell
+    {
+        unsigned seq;
+        T data;
+    };
+
+    //入队和出队位置分别放在不同的缓存行，生产者和消费者不会互相使对方的缓存行失效
+    cell *m_cells;
+    unsigned m_mask;
+    char m_pad0[64];
+    unsigned m_enqueue_pos;
+    char m_pad1[64];
+    unsigned m_dequeue_pos;
+    char m_pad2[64];
+    int m_waiters;          //正在或准备在futex上休眠的消费者数
+    unsigned m_futex;       //生产者唤醒时加1，休眠的消费者据此判断期间是否有新数据
+};
+
+#endif
@@ -0,0 +1,359 @@
+﻿#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <exception>
+#include "mpmc_queue.h"
+#include "ws_deque.h"
+
+//线程池的调度方式
+enum SCHED_POLICY
+{
+    SCHED_SHARED = 0,   //所有工作线程共用一个无锁队列
+    SCHED_STEAL,        //轮流放进各工作线程的队列，空闲的线程窃取其他线程的请求
+    SCHED_AFFINITY      //按fd固定放进一个工作线程的队列，排队过长时改投或被窃取
+};
+
+// 线程池的请求队列和调度
+// SCHED_SHARED直接使用mpmc_queue，工作线程空闲时在队列内部的futex上休眠。
+// 其余两种方式每个工作线程有一个收件箱(mpmc_queue)和一个Chase-Lev双端队列：
+// 事件循环有多个，不能直接push到只允许所属线程写入的双端队列，请求先放进收件箱，
+// 所属线程取出一个自己处理，其余搬到双端队列，之后从底部取；空闲的线程从其他线程的双端队列顶部和收件箱窃取。
+// SCHED_AFFINITY下同一连接的请求总是交给同一个工作线程，http_conn和它的缓冲区留在这个线程所在核的缓存中；
+// 为了不破坏亲和性，只从排队不少于STEAL_MIN的线程窃取，目标线程排队达到SKEW_DEPTH时改投排队少得多的线程。
+// 每个工作线程在自己的futex上休眠，push时目标线程在休眠就唤醒它，目标线程正忙且请求可以被窃取时唤醒另一个休眠的线程。
+template <typename T>
+class scheduler
+{
+public:
+    //max_requests是排队请求数的上限，按线程平均分到各自的队列
+    scheduler(int policy, int workers, int max_requests);
+    ~scheduler();
+
+    //请求入队，key为连接的fd，只有SCHED_AFFINITY用它选择工作线程；队列满时返回false
+    //request不能为NULL，内部用NULL表示没有取到请求
+    bool push(T *request, unsigned key);
+    //工作线程id取下一个请求，没有时休眠
+    T *pop(int id);
+    //工作线程id排队的请求数，SCHED_SHARED时为总数；并发读取，只是近似值
+    int depth(int id);
+    int workers()
+    {
+        return m_workers;
+    }
+    unsigned long processed(int id)
+    {
+        return __atomic_load_n(&m_stats[id].processed, __ATOMIC_RELAXED);
+    }
+    unsigned long stolen(int id)
+    {
+        return __atomic_load_n(&m_stats[id].stolen, __ATOMIC_RELAXED);
+    }
+    unsigned long rebalanced()
+    {
+        return __atomic_load_n(&m_rebalanced, __ATOMIC_RELAXED);
+    }
+    //打印各工作线程当前的排队数，以及上次打印以来的处理数、窃取数和改投次数，只在一个线程中调用
+    void print_stats();
+
+private:
+    struct local_queue
+    {
+        local_queue(int capacity) : inbox(capacity), deque(capacity), parked(0), futex(0) {}
+        mpmc_queue<T *> inbox;
+        ws_deque<T *> deque;
+        int parked;         //是否正在或准备休眠
+        unsigned futex;     //唤醒时加1，休眠前据此判断期间是否被唤醒
+        char pad[64];
+    };
+    //每个工作线程自己更新的计数，各占一个缓存行
+    struct worker_stat
+    {
+        unsigned long processed;
+        unsigned long stolen;
+        char pad[48];
+    };
+
+    static const int SPIN = 64;         //休眠前自旋查找的轮数
+    static const int STEAL_MIN = 2;     //SCHED_AFFINITY下排队达到这个数才允许被窃取
+    static const int SKEW_DEPTH = 4;    //SCHED_AFFINITY下排队达到这个数时考虑改投
+    static const int STAT_LINE = 4096;  //print_stats一行的长度上限
+
+    //选择接收请求的工作线程
+    int choose(unsigned key);
+    //依次查看自己的双端队列、自己的收件箱、其他线程的队列，不阻塞
+    T *find_request(int id);
+    //请求放进了busy的队列而busy没有休眠，有休眠的线程且请求允许被窃取时唤醒一个
+    void wake_thief(int busy);
+    void wake(int id);
+    //计数只由所属工作线程修改，不需要原子加
+    void count(unsigned long &counter)
+    {
+        __atomic_store_n(&counter, counter + 1, __ATOMIC_RELAXED);
+    }
+    //在buf的len处追加格式化的内容，超出STAT_LINE时截断，返回新的长度
+    static int append_stat(char *buf, int len, const char *fmt, ...);
+
+private:
+    int m_policy;
+    int m_workers;
+    mpmc_queue<T *> m_shared;       //SCHED_SHARED的请求队列
+    local_queue **m_local;          //其余方式下每个工作线程的队列
+    worker_stat *m_stats;
+    unsigned m_next_target;         //轮流选择工作线程
+    int m_parked;                   //休眠的工作线程数，为0时push不用查看各线程
+    unsigned long m_rebalanced;     //SCHED_AFFINITY下因排队过长改投的次数
+    unsigned long *m_last;          //print_stats上次打印时的计数
+};
+
+template <typename T>
+scheduler<T>::scheduler(int policy, int workers, int max_requests)
+    : m_policy(policy), m_workers(workers), m_shared(policy == SCHED_SHARED ? max_requests : 1), m_local(NULL),
+      m_next_target(0), m_parked(0), m_rebalanced(0)
+{
+    //未知的调度方式直接拒绝，print_stats按m_policy取名字
+    if (workers <= 0 || max_requests <= 0 || policy < SCHED_SHARED || policy > SCHED_AFFINITY)
+        throw std::exception();
+    if (m_policy != SCHED_SHARED)
+    {
+        int capacity = (max_requests + workers - 1) / workers;
+        m_local = new local_queue *[workers];
+        for (int i = 0; i < workers; ++i)
+            m_local[i] = new local_queue(capacity);
+    }
+    m_stats = new worker_stat[workers];
+    m_last = new unsigned long[2 * workers + 1];
+    for (int i = 0; i < workers; ++i)
+        m_stats[i].processed = m_stats[i].stolen = 0;
+    for (int i = 0; i < 2 * workers + 1; ++i)
+        m_last[i] = 0;
+}
+
+template <typename T>
+scheduler<T>::~scheduler()
+{
+    if (m_local)
+    {
+        for (int i = 0; i < m_workers; ++i)
+            delete m_local[i];
+        delete[] m_local;
+    }
+    delete[] m_stats;
+    delete[] m_last;
+}
+
+template <typename T>
+int scheduler<T>::depth(int id)
+{
+    if (m_policy == SCHED_SHARED)
+        return m_shared.size();
+    return m_local[id]->inbox.size() + m_local[id]->deque.size();
+}
+
+template <typename T>
+int scheduler<T>::choose(unsigned key)
+{
+    unsigned next = __atomic_fetch_add(&m_next_target, 1, __ATOMIC_RELAXED);
+    //只有SCHED_AFFINITY按key选择，其余都轮流投放
+    if (m_policy != SCHED_AFFINITY)
+        return next % m_workers;
+    //fd是按最小可用分配的小整数，直接取模就比较均匀
+    int target = key % m_workers;
+    int d = depth(target);
+    if (d < SKEW_DEPTH)
+        return target;
+    //轮流取一个候选，排队不到一半时改投
+    int alt = next % m_workers;
+    if (alt != target && depth(alt) * 2 < d)
+    {
+        __atomic_fetch_add(&m_rebalanced, 1, __ATOMIC_RELAXED);
+        return alt;
+    }
+    return target;
+}
+
+template <typename T>
+bool scheduler<T>::push(T *request, unsigned key)
+{
+    if (m_policy == SCHED_SHARED)
+        return m_shared.push(request);
+
+    int target = choose(key);
+    int i = 0;
+    for (; i < m_workers; ++i)
+        if (m_local[(target + i) % m_workers]->inbox.push(request))
+            break;
+    if (i == m_workers)
+        return false;
+    target = (target + i) % m_workers;
+
+    //与pop中登记休眠的顺序相反：先发布请求再检查休眠标记
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&m_parked, __ATOMIC_RELAXED) == 0)
+        return true;
+    if (__atomic_load_n(&m_local[target]->parked, __ATOMIC_RELAXED))
+        wake(target);
+    else
+        wake_thief(target);
+    return true;
+}
+
+template <typename T>
+void scheduler<T>::wake(int id)
+{
+    __atomic_fetch_add(&m_local[id]->futex, 1, __ATOMIC_RELAXED);
+    syscall(SYS_futex, &m_local[id]->futex, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+template <typename T>
+void scheduler<T>::wake_thief(int busy)
+{
+    if (m_policy == SCHED_AFFINITY && depth(busy) < STEAL_MIN)
+        return;
+    for (int i = 1; i < m_workers; ++i)
+    {
+        int id = (busy + i) % m_workers;
+        if (__atomic_load_n(&m_local[id]->parked, __ATOMIC_RELAXED))
+        {
+            wake(id);
+            return;
+        }
+    }
+}
+
+template <typename T>
+T *scheduler<T>::find_request(int id)
+{
+    local_queue *local = m_local[id];
+    T *request;
+    //自己的双端队列后进先出，刚搬进来的请求还在缓存中
+    if (local->deque.take(request))
+        return request;
+    //收件箱里的请求第一个自己处理，其余搬到双端队列，供以后处理或被其他线程窃取
+    if (local->inbox.try_pop(request))
+    {
+        T *more;
+        bool moved = false;
+        while (!local->deque.full() && local->inbox.try_pop(more))
+        {
+            local->deque.push(more);
+            moved = true;
+        }
+        //自己接下来要处理request，让休眠的线程来窃取剩下的
+        if (moved)
+        {
+            __atomic_thread_fence(__ATOMIC_SEQ_CST);
+            if (__atomic_load_n(&m_parked, __ATOMIC_RELAXED) > 0)
+                wake_thief(id);
+        }
+        return request;
+    }
+    //从下一个线程开始窃取，先取双端队列，所属线程正忙时收件箱里的请求也可以直接取走
+    for (int i = 1; i < m_workers; ++i)
+    {
+        int victim = (id + i) % m_workers;
+        if (m_policy == SCHED_AFFINITY && depth(victim) < STEAL_MIN)
+            continue;
+        if (m_local[victim]->deque.steal(request) || m_local[victim]->inbox.try_pop(request))
+        {
+            count(m_stats[id].stolen);
+            return request;
+        }
+    }
+    return NULL;
+}
+
+template <typename T>
+T *scheduler<T>::pop(int id)
+{
+    if (m_policy == SCHED_SHARED)
+    {
+        T *request = m_shared.pop();
+        count(m_stats[id].processed);
+        return request;
+    }
+
+    local_queue *local = m_local[id];
+    while (1)
+    {
+        for (int i = 0; i < SPIN; ++i)
+        {
+            T *request = find_request(id);
+            if (request)
+            {
+                count(m_stats[id].processed);
+                return request;
+            }
+            cpu_relax();
+        }
+        //先登记再读取futex的值并重新查找一次，没有找到且期间没有被唤醒才真正休眠
+        __atomic_store_n(&local->parked, 1, __ATOMIC_SEQ_CST);
+        __atomic_fetch_add(&m_parked, 1, __ATOMIC_SEQ_CST);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        unsigned val = __atomic_load_n(&local->futex, __ATOMIC_RELAXED);
+        T *request = find_request(id);
+        if (!request)
+            syscall(SYS_futex, &local->futex, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+        __atomic_fetch_sub(&m_parked, 1, __ATOMIC_RELAXED);
+        __atomic_store_n(&local->parked, 0, __ATOMIC_RELAXED);
+        if (request)
+        {
+            count(m_stats[id].processed);
+            return request;
+        }
+    }
+}
+
+template <typename T>
+int scheduler<T>::append_stat(char *buf, int len, const char *fmt, ...)
+{
+    if (len >= STAT_LINE - 1)
+        return len;
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(buf + len, STAT_LINE - len, fmt, args);
+    va_end(args);
+    if (n < 0)
+        return len;
+    return len + n < STAT_LINE - 1 ? len + n : STAT_LINE - 1;
+}
+
+template <typename T>
+void scheduler<T>::print_stats()
+{
+    static const char *names[] = {"shared", "steal", "affinity"};
+    char line[STAT_LINE];
+    int len = append_stat(line, 0, "[pool stat] %s depth", names[m_policy]);
+    if (m_policy == SCHED_SHARED)
+        len = append_stat(line, len, " %d", depth(0));
+    else
+        for (int i = 0; i < m_workers; ++i)
+            len = append_stat(line, len, "%s%d", i ? "/" : " ", depth(i));
+    len = append_stat(line, len, " processed");
+    for (int i = 0; i < m_workers; ++i)
+    {
+        unsigned long n = processed(i);
+        len = append_stat(line, len, "%s%lu", i ? "/" : " ", n - m_last[i]);
+        m_last[i] = n;
+    }
+    if (m_policy != SCHED_SHARED)
+    {
+        len = append_stat(line, len, " stolen");
+        for (int i = 0; i < m_workers; ++i)
+        {
+            unsigned long n = stolen(i);
+            len = append_stat(line, len, "%s%lu", i ? "/" : " ", n - m_last[m_workers + i]);
+            m_last[m_workers + i] = n;
+        }
+    }
+    if (m_policy == SCHED_AFFINITY)
+    {
+        unsigned long n = rebalanced();
+        len = append_stat(line, len, " rebalanced %lu", n - m_last[2 * m_workers]);
+        m_last[2 * m_workers] = n;
+    }
+    printf("%s\n", line);
+}
+
+#endif
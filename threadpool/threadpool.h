@@ -1,11 +1,10 @@
 ﻿#ifndef THREADPOOL_H
 #define THREADPOOL_H
 
-#include <list>
 #include <cstdio>
 #include <exception>
 #include <pthread.h>
-#include "../lock/locker.h"
+#include "scheduler.h"
 #include "../CGImysql/sql_connection_pool.h"
 
 template <typename T>
@@ -13,9 +12,18 @@ class threadpool
 {
 public:
     /*thread_number是线程池中线程的数量，max_requests是请求队列中最多允许的、等待处理的请求的数量*/
-    threadpool(connection_pool *connPool, int thread_number = 8, int max_request = 10000);
+    /*actor_model为0是模拟Proactor，工作线程只负责解析；为1是Reactor，工作线程自己完成socket读写*/
+    /*policy为SCHED_POLICY：0所有工作线程共用一个请求队列；1工作窃取；2按连接固定工作线程，排队过长时改投或被窃取*/
+    threadpool(int actor_model, connection_pool *connPool, int thread_number = 8, int max_request = 10000, int policy = SCHED_SHARED);
     ~threadpool();
     bool append(T *request);
+    /*Reactor模式入队，state为0表示读事件，1表示写事件*/
+    bool append(T *request, int state);
+    /*打印各工作线程的排队数和处理数，由0号事件循环定时调用*/
+    void print_stats()
+    {
+        m_workqueue.print_stats();
+    }
 
 private:
     /*工作线程运行的函数，它不断从工作队列中取出任务并执行之*/
@@ -27,18 +35,17 @@ private:
     int m_thread_number;        //线程池中的线程数
     int m_max_requests;         //请求队列中允许的最大请求数
     pthread_t *m_threads;       //描述线程池的数组，其大小为m_thread_number
-    std::list<T *> m_workqueue; //请求队列
-    locker m_queuelocker;       //保护请求队列的互斥锁
-    sem m_queuestat;            //是否有任务需要处理
+    scheduler<T> m_workqueue;   //请求队列，按调度方式分配给工作线程，空时工作线程在futex上休眠
     bool m_stop;                //是否结束线程
     connection_pool *m_connPool;  //数据库
+    int m_actor_model;          //事件处理模式
+    int m_next_id;              //工作线程启动时依次取得的编号
 };
 template <typename T>
-threadpool<T>::threadpool( connection_pool *connPool, int thread_number, int max_requests) : 
-m_thread_number(thread_number), m_max_requests(max_requests), m_stop(false), m_threads(NULL),m_connPool(connPool)
+threadpool<T>::threadpool(int actor_model, connection_pool *connPool, int thread_number, int max_requests, int policy) : 
+m_thread_number(thread_number), m_max_requests(max_requests), m_stop(false), m_threads(NULL), m_workqueue(policy, thread_number, max_requests),
+m_connPool(connPool), m_actor_model(actor_model), m_next_id(0)
 {
-    if (thread_number <= 0 || max_requests <= 0)
-        throw std::exception();
     m_threads = new pthread_t[m_thread_number];
     if (!m_threads)
         throw std::exception();
@@ -72,20 +79,17 @@ threadpool<T>::~threadpool()
     delete[] m_threads;
     m_stop = true;
 }
-// 请求入队
+// 请求入队，队列满时返回false；按连接的fd选择工作线程，有工作线程在休眠时由队列唤醒
 template <typename T>
 bool threadpool<T>::append(T *request)
 {
-    m_queuelocker.lock();
-    if (m_workqueue.size() > m_max_requests)
-    {
-        m_queuelocker.unlock();
-        return false;
-    }
-    m_workqueue.push_back(request);
-    m_queuelocker.unlock();
-    m_queuestat.post();     // 队列里多了一个请求
-    return true;
+    return m_workqueue.push(request, request->get_sockfd());
+}
+template <typename T>
+bool threadpool<T>::append(T *request, int state)
+{
+    request->m_state = state;
+    return append(request);
 }
 /*相当于一个入口，不断从请求队列中取出创建线程，执行run()，并被detach，执行完后自动销毁*/
 template <typename T>
@@ -98,20 +102,40 @@ void *threadpool<T>::worker(void *arg)
 template <typename T>
 void threadpool<T>::run()
 {
+    int id = __atomic_fetch_add(&m_next_id, 1, __ATOMIC_RELAXED);
     while (!m_stop)
     {
-        m_queuestat.wait();     // 即将从队列中取出一个请求
-        m_queuelocker.lock();
-        if (m_workqueue.empty())
+        T *request = m_workqueue.pop(id);     // 队列空时阻塞
+        if (!request)
+            continue;
+
+        //Reactor模式下由工作线程完成读写，失败时交还事件循环关闭连接
+        if (1 == m_actor_model)
         {
-            m_queuelocker.unlock();
+            if (0 == request->m_state)
+            {
+                if (request->read_once())
+                {
+                    connectionRAII mysqlcon(&request->mysql, m_connPool);
+                    request->process();
+                }
+                else
+                    request->close_conn();
+            }
+            else
+            {
+                bool pending = false;
+                if (!request->write(pending))
+                    request->close_conn();
+                //流水线的后续请求已经读入，接着解析
+                else if (pending)
+                {
+                    connectionRAII mysqlcon(&request->mysql, m_connPool);
+                    request->process();
+                }
+            }
             continue;
         }
-        T *request = m_workqueue.front();
-        m_workqueue.pop_front();
-        m_queuelocker.unlock();
-        if (!request)
-            continue;
 
         connectionRAII mysqlcon(&request->mysql, m_connPool);
         
@@ -0,0 +1,103 @@
+﻿#ifndef WS_DEQUE_H
+#define WS_DEQUE_H
+
+#include <exception>
+#include <limits.h>
+
+// 工作窃取双端队列(Chase-Lev)，内存序按Lê等人给出的弱内存模型版本
+// 只有所属的工作线程在底部push和take，后进先出；其他线程从顶部steal，先进先出。
+// 所属线程的push/take只在队列剩最后一个元素时才与窃取者竞争一次CAS，平时只读写自己的bottom。
+// 容量固定为2的幂，不扩容，满时push返回false，由调用者把任务留在别处。
+template <typename T>
+class ws_deque
+{
+public:
+    explicit ws_deque(int capacity) : m_top(0), m_bottom(0)
+    {
+        if (capacity <= 0 || capacity > INT_MAX / 2)
+            throw std::exception();
+        long size = 1;
+        while (size < capacity)
+            size <<= 1;
+        m_mask = size - 1;
+        m_buf = new T[size];
+    }
+    ~ws_deque()
+    {
+        delete[] m_buf;
+    }
+
+    //只能由所属线程调用
+    bool push(T data)
+    {
+        long b = __atomic_load_n(&m_bottom, __ATOMIC_RELAXED);
+        long t = __atomic_load_n(&m_top, __ATOMIC_ACQUIRE);
+        if (b - t > m_mask)
+            return false;
+        __atomic_store_n(&m_buf[b & m_mask], data, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        __atomic_store_n(&m_bottom, b + 1, __ATOMIC_RELAXED);
+        return true;
+    }
+
+    //只能由所属线程调用，取出最近push的元素
+    bool take(T &data)
+    {
+        long b = __atomic_load_n(&m_bottom, __ATOMIC_RELAXED) - 1;
+        __atomic_store_n(&m_bottom, b, __ATOMIC_RELAXED);
+        //先让窃取者看到bottom减小，再读top
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        long t = __atomic_load_n(&m_top, __ATOMIC_RELAXED);
+        if (t > b)
+        {
+            //队列空，恢复bottom
+            __atomic_store_n(&m_bottom, b + 1, __ATOMIC_RELAXED);
+            return false;
+        }
+        data = __atomic_load_n(&m_buf[b & m_mask], __ATOMIC_RELAXED);
+        if (t == b)
+        {
+            //最后一个元素，和窃取者抢top
+            bool won = __atomic_compare_exchange_n(&m_top, &t, t + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+            __atomic_store_n(&m_bottom, b + 1, __ATOMIC_RELAXED);
+            return won;
+        }
+        return true;
+    }
+
+    //任意线程调用，取出最早push的元素；队列空或与其他线程竞争失败时返回false
+    bool steal(T &data)
+    {
+        long t = __atomic_load_n(&m_top, __ATOMIC_ACQUIRE);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        long b = __atomic_load_n(&m_bottom, __ATOMIC_ACQUIRE);
+        if (t >= b)
+            return false;
+        data = __atomic_load_n(&m_buf[t & m_mask], __ATOMIC_RELAXED);
+        return __atomic_compare_exchange_n(&m_top, &t, t + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+    }
+
+    //任意线程调用，并发时只是近似值
+    int size()
+    {
+        long n = __atomic_load_n(&m_bottom, __ATOMIC_RELAXED) - __atomic_load_n(&m_top, __ATOMIC_RELAXED);
+        return n > 0 ? (int)n : 0;
+    }
+
+    //只能由所属线程调用
+    bool full()
+    {
+        return __atomic_load_n(&m_bottom, __ATOMIC_RELAXED) - __atomic_load_n(&m_top, __ATOMIC_ACQUIRE) > m_mask;
+    }
+
+private:
+    T *m_buf;
+    long m_mask;
+    char m_pad0[64];
+    long m_top;         //窃取者竞争的一端
+    char m_pad1[64];
+    long m_bottom;      //所属线程的一端
+    char m_pad2[64];
+};
+
+#endif
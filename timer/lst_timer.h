@@ -7,6 +7,7 @@ class util_timer;       // 
 struct client_data{
     sockaddr_in address;
     int sockfd;
+    int epollfd;        // ¼ѭepollfd
     util_timer *timer;
 };
 
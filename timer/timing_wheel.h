@@ -0,0 +1,191 @@
+﻿#ifndef TIMING_WHEEL_H
+#define TIMING_WHEEL_H
+
+#include <time.h>
+#include "lst_timer.h"
+
+//单调时钟的毫秒数，定时器的expire都按这个时钟计算
+inline time_t monotonic_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// 分层时间轮，接口与sort_timer_lst相同，时间单位为毫秒
+// 4层、每层64个槽，第0层每槽1毫秒，第i层每槽64^i毫秒，最多覆盖2^24毫秒(约4.6小时)。
+// 每个槽是以哨兵结点为头的循环双向链表，插入、调整和删除都只改几个指针，与定时器总数无关；
+// 高层的槽在低层转完一圈时整体下放(cascade)到低一层，每个定时器最多被移动3次。
+// 每层用一个64位的位图记录非空的槽，tick跳过空槽，next_expire据此给出下一次需要处理的时间。
+// 定时器结点由调用者提供(嵌在连接对象中)，时间轮只负责挂上和取下，不申请也不释放，
+// 设置、刷新和取消定时器都不经过堆分配。
+class timing_wheel
+{
+public:
+    static const int LEVELS = 4;
+    static const int BITS = 6;
+    static const int SLOTS = 1 << BITS;
+
+    timing_wheel() : m_now(monotonic_ms()), m_count(0)
+    {
+        for (int i = 0; i < LEVELS; ++i)
+        {
+            m_bits[i] = 0;
+            for (int j = 0; j < SLOTS; ++j)
+                m_slots[i][j].prev = m_slots[i][j].next = &m_slots[i][j];
+        }
+    }
+
+    void add_timer(util_timer *timer)
+    {
+        if (!timer)
+            return;
+        place(timer);
+        ++m_count;
+    }
+    //expire已经由调用者更新，从原来的槽中取下重新放入
+    void adjust_timer(util_timer *timer)
+    {
+        if (!timer)
+            return;
+        unlink(timer);
+        place(timer);
+    }
+    //只从时间轮取下，结点仍归调用者所有
+    void del_timer(util_timer *timer)
+    {
+        if (!timer || !timer->next)
+            return;
+        unlink(timer);
+        --m_count;
+    }
+    void tick()
+    {
+        tick(monotonic_ms());
+    }
+    //处理到cur为止(含)到期的定时器
+    void tick(time_t cur)
+    {
+        //没有定时器时直接跳到当前时间，不用逐槽转动
+        if (m_count == 0)
+        {
+            if (cur >= m_now)
+                m_now = cur + 1;
+            return;
+        }
+        while (m_now <= cur)
+        {
+            int idx = m_now & (SLOTS - 1);
+            //第0层转完一圈，依次下放上层对应的槽
+            if (idx == 0)
+                for (int level = 1; level < LEVELS && cascade(level) == 0; ++level)
+                    ;
+            util_timer *head = &m_slots[0][idx];
+            while (head->next != head)
+            {
+                //先取下再回调，回调会把结点所在的连接对象放回连接池，之后不能再访问tmp
+                util_timer *tmp = head->next;
+                unlink(tmp);
+                --m_count;
+                tmp->cb_func(tmp->user_data);
+            }
+            m_bits[0] &= ~(1ULL << idx);
+            //跳到本圈下一个非空槽，没有时跳到下一圈的起点下放上层
+            unsigned long long rest = m_bits[0] & ~((2ULL << idx) - 1);
+            time_t next = rest ? m_now - idx + __builtin_ctzll(rest) : (m_now | (SLOTS - 1)) + 1;
+            m_now = next <= cur ? next : cur + 1;
+        }
+    }
+    //下一次需要tick的时间：第0层最近的非空槽，或高层最近一个要下放的槽，都不早于其中定时器的到期时间；
+    //没有定时器时返回-1。已经取消的定时器留下的空槽在这里清除标记
+    time_t next_expire()
+    {
+        if (m_count == 0)
+            return -1;
+        time_t best = -1;
+        for (int level = 0; level < LEVELS; ++level)
+        {
+            int shift = BITS * level;
+            time_t slot = m_now >> shift;
+            int idx = slot & (SLOTS - 1);
+            //m_now正好在本层槽的起点时当前槽还没处理；否则当前槽里是下一圈的定时器
+            bool current = (m_now & (((time_t)1 << shift) - 1)) == 0;
+            while (m_bits[level])
+            {
+                unsigned long long bits = m_bits[level];
+                unsigned long long rot = idx ? (bits >> idx) | (bits << (SLOTS - idx)) : bits;
+                if (!current)
+                    rot &= ~1ULL;
+                int d = rot ? __builtin_ctzll(rot) : SLOTS;
+                int j = (idx + d) & (SLOTS - 1);
+                util_timer *head = &m_slots[level][j];
+                if (head->next == head)
+                {
+                    m_bits[level] &= ~(1ULL << j);
+                    continue;
+                }
+                time_t when = (slot + d) << shift;
+                if (best < 0 || when < best)
+                    best = when;
+                break;
+            }
+        }
+        return best;
+    }
+
+private:
+    static void unlink(util_timer *timer)
+    {
+        timer->prev->next = timer->next;
+        timer->next->prev = timer->prev;
+        timer->prev = timer->next = NULL;
+    }
+    //按距离m_now的毫秒数选层，已经过期的放在马上要处理的槽
+    void place(util_timer *timer)
+    {
+        time_t expire = timer->expire;
+        time_t delta = expire - m_now;
+        int level = 0;
+        if (delta < 0)
+            expire = m_now;
+        else
+        {
+            while (level < LEVELS - 1 && delta >= (time_t)1 << (BITS * (level + 1)))
+                ++level;
+            //超出范围时放在最高层最远的槽，下放时再按真实时间重新放置
+            if (delta >= (time_t)1 << (BITS * LEVELS))
+                expire = m_now + ((time_t)1 << (BITS * LEVELS)) - 1;
+        }
+        int idx = (expire >> (BITS * level)) & (SLOTS - 1);
+        util_timer *head = &m_slots[level][idx];
+        m_bits[level] |= 1ULL << idx;
+        timer->next = head;
+        timer->prev = head->prev;
+        head->prev->next = timer;
+        head->prev = timer;
+    }
+    //把level层当前的槽整体放回低层，返回该槽的下标，为0时上一层也要下放
+    int cascade(int level)
+    {
+        int idx = (m_now >> (BITS * level)) & (SLOTS - 1);
+        util_timer *head = &m_slots[level][idx];
+        util_timer *tmp = head->next;
+        head->prev = head->next = head;
+        m_bits[level] &= ~(1ULL << idx);
+        while (tmp != head)
+        {
+            util_timer *next = tmp->next;
+            place(tmp);
+            tmp = next;
+        }
+        return idx;
+    }
+
+private:
+    util_timer m_slots[LEVELS][SLOTS];  //每个槽的哨兵结点
+    unsigned long long m_bits[LEVELS];  //非空的槽，取消定时器时不清除，可能多出空槽
+    time_t m_now;                       //下一个要处理的毫秒
+    int m_count;                        //定时器总数
+};
+
+#endif